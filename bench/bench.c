@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// ---------------------------------------------------------------------------
+// Benchmark harness for `make bench`.
+//
+//   bench [--runs=N] [--tolerance=PCT] [--baseline=file] [--write-baseline=file]
+//         <tool> <treedir> [-- tool-args...]
+//
+// Runs <tool> over every tree generated by gentree in three modes:
+//   cold    file data evicted from the page cache before every run
+//   warm    page cache hot, scan cache disabled
+//   cached  page cache hot, scan cache populated
+// taking the best of N runs for each, and prints one tab-separated row per
+// tree and mode with files/s, MB/s, peak RSS and the number of system calls
+// (counted in a separate, traced run). With --baseline, rows are compared
+// against a stored baseline. Wall time and RSS depend on the machine and its
+// load, so differences there are only reported; the exit status is 1 only
+// if a deterministic column regressed: the tree is not the one the baseline
+// was taken on, or the tool made more system calls.
+// ---------------------------------------------------------------------------
+#define MAX_TOOL_ARGS 64
+#define MAX_ROWS 64
+#define RSS_TOLERANCE 0.25
+#define SYSCALL_TOLERANCE 0.05
+#define TIME_SLACK_SEC 0.02    // absolute noise floor for very short runs
+
+// Offset of the syscall number in struct ptrace_syscall_info
+#define SYSCALL_INFO_NR 24
+
+#ifndef PTRACE_GET_SYSCALL_INFO
+#define PTRACE_GET_SYSCALL_INFO 0x420e
+#endif
+#define SYSCALL_INFO_ENTRY 1
+
+// Waiting between threads: how often depends on scheduling, not on the
+// tool, so these are not counted.
+static const long waitSyscalls[] = {SYS_futex, SYS_nanosleep, SYS_clock_nanosleep, SYS_sched_yield};
+
+static const char *trees[] = {"tiny", "huge", "deep", "wide", "exts"};
+
+typedef struct {
+    char tree[16];
+    char mode[16];
+    long files;
+    double mb;
+    double seconds;
+    long rssKb;
+    long syscalls;    // -1 when tracing is not permitted
+} BenchRow;
+
+typedef struct {
+    long files;
+    long long bytes;
+} TreeSize;
+
+static TreeSize treeSize;
+static int evictFailed;
+
+// ---------------------------------------------------------------------------
+// Tree helpers
+// ---------------------------------------------------------------------------
+static int count_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void) path;
+    (void) ftw;
+    if (flag == FTW_F && S_ISREG(st->st_mode)) {
+        treeSize.files++;
+        treeSize.bytes += st->st_size;
+    }
+    return 0;
+}
+
+// Drops the file's pages from the page cache; works without privileges.
+static int evict_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void) st;
+    (void) ftw;
+    if (flag != FTW_F && flag != FTW_D)
+        return 0;
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0)
+        return 0;
+    if (posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0)
+        evictFailed = 1;
+    close(fd);
+    return 0;
+}
+
+// Evicts the tree from the page cache: drop_caches when permitted (also
+// drops dentries and inodes), otherwise POSIX_FADV_DONTNEED per file.
+static void evict_tree(const char *root) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd >= 0) {
+        ssize_t n = write(fd, "3", 1);
+        close(fd);
+        if (n == 1)
+            return;
+    }
+    nftw(root, evict_entry, 64, FTW_PHYS);
+}
+
+// ---------------------------------------------------------------------------
+// Running the tool
+// ---------------------------------------------------------------------------
+static pid_t spawn(char **argv, int traced) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+        if (traced) {
+            if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0)
+                _exit(126);
+            raise(SIGSTOP);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Runs argv once; returns its wall time and stores its peak RSS in KB.
+static double run_timed(char **argv, long *rssKb) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = spawn(argv, 0);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench: %s failed\n", argv[0]);
+        exit(1);
+    }
+    *rssKb = usage.ru_maxrss;
+    return (double) (end.tv_sec - start.tv_sec) + (double) (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static int is_wait_syscall(long nr) {
+    for (size_t i = 0; i < sizeof(waitSyscalls) / sizeof(waitSyscalls[0]); i++) {
+        if (waitSyscalls[i] == nr)
+            return 1;
+    }
+    return 0;
+}
+
+// Runs argv under ptrace and counts system call entries across all threads,
+// except those in waitSyscalls. Returns -1 if tracing is not permitted.
+static long count_syscalls(char **argv) {
+    pid_t pid = spawn(argv, 1);
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFSTOPPED(status)) {
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            return -1;
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+    long options = PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK |
+                   PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL;
+    if (ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *) options) != 0 ||
+        ptrace(PTRACE_SYSCALL, pid, NULL, NULL) != 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        return -1;
+    }
+    long count = 0;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid < 0)
+            break;    // ECHILD: every traced thread has exited
+        if (!WIFSTOPPED(status))
+            continue;
+        int sig = WSTOPSIG(status);
+        if (sig == (SIGTRAP | 0x80)) {
+            unsigned char info[128];
+            uint64_t nr;
+            if (ptrace(PTRACE_GET_SYSCALL_INFO, tid, (void *) sizeof(info), info) > SYSCALL_INFO_NR &&
+                info[0] == SYSCALL_INFO_ENTRY) {
+                memcpy(&nr, info + SYSCALL_INFO_NR, sizeof(nr));
+                if (!is_wait_syscall((long) nr))
+                    count++;
+            }
+            sig = 0;
+        } else if ((status >> 16) != 0 || sig == SIGSTOP || sig == SIGTRAP) {
+            sig = 0;    // ptrace events and the initial stop of new threads
+        }
+        ptrace(PTRACE_SYSCALL, tid, NULL, (void *) (long) sig);
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Baseline comparison
+// ---------------------------------------------------------------------------
+static int load_rows(const char *path, BenchRow *rows, int maxRows) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char line[512];
+    int n = 0;
+    while (n < maxRows && fgets(line, sizeof(line), f)) {
+        BenchRow r;
+        double filesPerSec, mbPerSec;
+        char syscalls[32];
+        if (sscanf(line, "%15s %15s %ld %lf %lf %lf %lf %ld %31s", r.tree, r.mode, &r.files, &r.mb,
+                   &r.seconds, &filesPerSec, &mbPerSec, &r.rssKb, syscalls) != 9)
+            continue;    // header or malformed line
+        r.syscalls = strcmp(syscalls, "-") == 0 ? -1 : atol(syscalls);
+        rows[n++] = r;
+    }
+    fclose(f);
+    return n;
+}
+
+static void print_row(FILE *out, const BenchRow *r) {
+    fprintf(out, "%s\t%s\t%ld\t%.1f\t%.4f\t%.0f\t%.1f\t%ld\t", r->tree, r->mode, r->files, r->mb, r->seconds,
+            r->seconds > 0 ? (double) r->files / r->seconds : 0.0, r->seconds > 0 ? r->mb / r->seconds : 0.0,
+            r->rssKb);
+    if (r->syscalls < 0)
+        fprintf(out, "-");
+    else
+        fprintf(out, "%ld", r->syscalls);
+}
+
+static const char *row_header = "tree\tmode\tfiles\tmb\tseconds\tfiles_per_s\tmb_per_s\tpeak_rss_kb\tsyscalls";
+
+// Appends the comparison columns for `r`; returns 1 if it regressed. Only
+// the tree and the system call count can; a slower or bigger run is marked
+// in the status column but does not fail, since the baseline may come from
+// another machine. Refresh it with `make bench-baseline` on the machine at
+// hand to compare times that mean something.
+static int compare_row(const BenchRow *r, const BenchRow *base, int numBase, double tolerance) {
+    const BenchRow *b = NULL;
+    for (int i = 0; i < numBase; i++) {
+        if (strcmp(base[i].tree, r->tree) == 0 && strcmp(base[i].mode, r->mode) == 0) {
+            b = &base[i];
+            break;
+        }
+    }
+    if (!b) {
+        printf("\t-\t-\tnew\n");
+        return 0;
+    }
+    char status[64] = "", notes[64] = "";
+    if (r->files != b->files || (long) (r->mb * 10 + 0.5) != (long) (b->mb * 10 + 0.5))
+        strcat(status, ",tree");
+    if (r->syscalls >= 0 && b->syscalls >= 0 &&
+        r->syscalls > (long) ((double) b->syscalls * (1.0 + SYSCALL_TOLERANCE)))
+        strcat(status, ",syscalls");
+    if (r->seconds > b->seconds * (1.0 + tolerance) + TIME_SLACK_SEC)
+        strcat(notes, ",slower");
+    if (r->rssKb > (long) ((double) b->rssKb * (1.0 + RSS_TOLERANCE)))
+        strcat(notes, ",bigger");
+    double delta = b->seconds > 0 ? (r->seconds / b->seconds - 1.0) * 100.0 : 0.0;
+    printf("\t%.4f\t%+.1f\t%s\n", b->seconds, delta, status[0] ? "REGRESSION" : notes[0] ? notes + 1 : "ok");
+    if (status[0])
+        fprintf(stderr, "bench: %s/%s regressed (%s)\n", r->tree, r->mode, status + 1);
+    return status[0] != '\0';
+}
+
+// ---------------------------------------------------------------------------
+// Main
+// ---------------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+    int runs = 5;
+    double tolerance = 0.15;
+    const char *baselinePath = NULL, *writePath = NULL;
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0 && argv[i][2] != '\0'; i++) {
+        if (strncmp(argv[i], "--runs=", 7) == 0)
+            runs = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--tolerance=", 12) == 0)
+            tolerance = atof(argv[i] + 12) / 100.0;
+        else if (strncmp(argv[i], "--baseline=", 11) == 0)
+            baselinePath = argv[i] + 11;
+        else if (strncmp(argv[i], "--write-baseline=", 17) == 0)
+            writePath = argv[i] + 17;
+        else {
+            fprintf(stderr, "bench: unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (argc - i < 2) {
+        fprintf(stderr, "Usage: %s [--runs=N] [--tolerance=PCT] [--baseline=file] [--write-baseline=file] "
+                        "<tool> <treedir> [-- tool-args...]\n", argv[0]);
+        return 1;
+    }
+    if (runs < 1)
+        runs = 1;
+    const char *tool = argv[i];
+    const char *treeDir = argv[i + 1];
+    char **extraArgs = argv + i + 2;
+    int numExtra = argc - i - 2;
+    if (numExtra > 0 && strcmp(extraArgs[0], "--") == 0) {
+        extraArgs++;
+        numExtra--;
+    }
+    if (numExtra > MAX_TOOL_ARGS - 8) {
+        fprintf(stderr, "bench: too many tool arguments\n");
+        return 1;
+    }
+
+    BenchRow base[MAX_ROWS], rows[MAX_ROWS];
+    int numBase = 0, numRows = 0;
+    if (baselinePath) {
+        numBase = load_rows(baselinePath, base, MAX_ROWS);
+        if (numBase < 0) {
+            fprintf(stderr, "bench: no baseline at %s; run `make bench-baseline` to create one\n", baselinePath);
+            numBase = 0;
+        }
+    }
+
+    printf("%s%s\n", row_header, baselinePath ? "\tbaseline_seconds\tdelta_pct\tstatus" : "");
+    fflush(stdout);
+    int regressions = 0;
+    static const char *modes[] = {"cold", "warm", "cached"};
+    for (size_t t = 0; t < sizeof(trees) / sizeof(trees[0]); t++) {
+        char root[PATH_MAX], cacheArg[PATH_MAX + 16];
+        snprintf(root, sizeof(root), "%s/%s", treeDir, trees[t]);
+        snprintf(cacheArg, sizeof(cacheArg), "--cache-file=%s/.cache-%s", treeDir, trees[t]);
+        treeSize = (TreeSize){0, 0};
+        if (nftw(root, count_entry, 64, FTW_PHYS) != 0) {
+            fprintf(stderr, "bench: cannot walk %s; run gentree first\n", root);
+            return 1;
+        }
+
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            int cached = strcmp(modes[m], "cached") == 0;
+            char *toolArgv[MAX_TOOL_ARGS];
+            int n = 0;
+            toolArgv[n++] = (char *) tool;
+            toolArgv[n++] = "--no-color";
+            toolArgv[n++] = cached ? cacheArg : "--no-cache";
+            for (int e = 0; e < numExtra; e++)
+                toolArgv[n++] = extraArgs[e];
+            toolArgv[n++] = root;
+            toolArgv[n] = NULL;
+
+            BenchRow r = {"", "", treeSize.files, (double) treeSize.bytes / (1024.0 * 1024.0), 0, 0, -1};
+            snprintf(r.tree, sizeof(r.tree), "%s", trees[t]);
+            snprintf(r.mode, sizeof(r.mode), "%s", modes[m]);
+            long rss;
+            int cold = strcmp(modes[m], "cold") == 0;
+            if (cached) {
+                // Populate the scan cache without timing it.
+                toolArgv[n - 1] = "--rebuild-cache";
+                toolArgv[n] = root;
+                toolArgv[n + 1] = NULL;
+                run_timed(toolArgv, &rss);
+                toolArgv[n - 1] = root;
+                toolArgv[n] = NULL;
+            } else if (!cold) {
+                run_timed(toolArgv, &rss);
+            }
+            for (int k = 0; k < runs; k++) {
+                if (cold)
+                    evict_tree(root);
+                double s = run_timed(toolArgv, &rss);
+                if (k == 0 || s < r.seconds)
+                    r.seconds = s;
+                if (rss > r.rssKb)
+                    r.rssKb = rss;
+            }
+            r.syscalls = count_syscalls(toolArgv);
+
+            print_row(stdout, &r);
+            if (baselinePath)
+                regressions += compare_row(&r, base, numBase, tolerance);
+            else
+                printf("\n");
+            fflush(stdout);
+            if (numRows < MAX_ROWS)
+                rows[numRows++] = r;
+        }
+    }
+    if (evictFailed)
+        fprintf(stderr, "bench: could not evict some files; cold numbers may be warm\n");
+
+    if (writePath) {
+        FILE *f = fopen(writePath, "w");
+        if (!f) {
+            perror(writePath);
+            return 1;
+        }
+        fprintf(f, "%s\n", row_header);
+        for (int k = 0; k < numRows; k++) {
+            print_row(f, &rows[k]);
+            fprintf(f, "\n");
+        }
+        fclose(f);
+        fprintf(stderr, "bench: wrote baseline %s\n", writePath);
+    }
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// ---------------------------------------------------------------------------
+// Deterministic synthetic trees for `make bench`.
+//
+//   gentree <dir> [scale]
+//
+// Creates <dir>/tiny, huge, deep, wide and exts. Every byte comes from a
+// fixed-seed PRNG, so the same version and scale always produce the same
+// trees. A stamp file makes re-runs with unchanged parameters a no-op.
+// ---------------------------------------------------------------------------
+#define GENTREE_VERSION 1
+#define STAMP_NAME ".gentree-stamp"
+#define WRITE_BUF_SIZE (64 * 1024)
+
+typedef struct {
+    uint64_t s;
+} Rng;
+
+static uint64_t rng_next(Rng *r) {
+    // xorshift64*
+    r->s ^= r->s >> 12;
+    r->s ^= r->s << 25;
+    r->s ^= r->s >> 27;
+    return r->s * 0x2545F4914F6CDD1DULL;
+}
+
+static Rng rng_seed(const char *tree, long index) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const char *p = tree; *p; p++)
+        h = (h ^ (unsigned char) *p) * 1099511628211ULL;
+    Rng r = {h ^ ((uint64_t) index * 0x9E3779B97F4A7C15ULL)};
+    if (r.s == 0)
+        r.s = 1;
+    rng_next(&r);
+    return r;
+}
+
+// `path` is relative to `dirfd` (AT_FDCWD for the current directory).
+static void make_dir(int dirfd, const char *path) {
+    if (mkdirat(dirfd, path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        exit(1);
+    }
+}
+
+// Opens the directory `path` in `dirfd`.
+static int open_dir(int dirfd, const char *path) {
+    int fd = openat(dirfd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        exit(1);
+    }
+    return fd;
+}
+
+// Writes `size` bytes of text to `path` in `dirfd`: lines of 0-119
+// printable characters.
+static void write_file(int dirfd, const char *path, long long size, Rng *r) {
+    static const char charset[] = "abcdefghijklmnopqrstuvwxyz ABCDEFGHIJKLMNOPQRSTUVWXYZ 0123456789 {}();=+-*/";
+    int fd = openat(dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    FILE *f = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char buf[WRITE_BUF_SIZE];
+    long long left = size;
+    int lineLeft = (int) (rng_next(r) % 120);
+    while (left > 0) {
+        size_t n = left < (long long) sizeof(buf) ? (size_t) left : sizeof(buf);
+        for (size_t i = 0; i < n; i++) {
+            if (lineLeft-- == 0) {
+                buf[i] = '\n';
+                lineLeft = (int) (rng_next(r) % 120);
+            } else {
+                buf[i] = charset[rng_next(r) % (sizeof(charset) - 1)];
+            }
+        }
+        if (fwrite(buf, 1, n, f) != n) {
+            perror(path);
+            exit(1);
+        }
+        left -= (long long) n;
+    }
+    if (fclose(f) != 0) {
+        perror(path);
+        exit(1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Tree shapes
+// ---------------------------------------------------------------------------
+
+// Many tiny files spread over a two-level layout of small directories.
+static void gen_tiny(const char *root, int scale) {
+    char path[PATH_MAX];
+    Rng r = rng_seed("tiny", 0);
+    int numDirs = 200 * scale;
+    for (int d = 0; d < numDirs; d++) {
+        snprintf(path, sizeof(path), "%s/g%02d", root, d % 20);
+        make_dir(AT_FDCWD, path);
+        snprintf(path, sizeof(path), "%s/g%02d/d%04d", root, d % 20, d);
+        make_dir(AT_FDCWD, path);
+        for (int f = 0; f < 100; f++) {
+            snprintf(path, sizeof(path), "%s/g%02d/d%04d/f%03d.txt", root, d % 20, d, f);
+            write_file(AT_FDCWD, path, (long long) (rng_next(&r) % 1024), &r);
+        }
+    }
+}
+
+// A few large files: the throughput of the newline counting dominates.
+static void gen_huge(const char *root, int scale) {
+    char path[PATH_MAX];
+    Rng r = rng_seed("huge", 0);
+    for (int f = 0; f < 4; f++) {
+        snprintf(path, sizeof(path), "%s/big%d.log", root, f);
+        write_file(AT_FDCWD, path, 32LL * 1024 * 1024 * scale, &r);
+    }
+}
+
+// One long chain of nested directories with a couple of files per level.
+// Each level is created relative to the one above, so the depth is not
+// limited by PATH_MAX.
+static void gen_deep(const char *root, int scale) {
+    Rng r = rng_seed("deep", 0);
+    int depth = 400 * scale;
+    int dirfd = open_dir(AT_FDCWD, root);
+    for (int level = 0; level < depth; level++) {
+        make_dir(dirfd, "n");
+        int child = open_dir(dirfd, "n");
+        close(dirfd);
+        dirfd = child;
+        for (int f = 0; f < 2; f++) {
+            char name[16];
+            snprintf(name, sizeof(name), "f%d.c", f);
+            write_file(dirfd, name, (long long) (rng_next(&r) % 4096), &r);
+        }
+    }
+    close(dirfd);
+}
+
+// A single directory with a very large number of entries.
+static void gen_wide(const char *root, int scale) {
+    char path[PATH_MAX];
+    Rng r = rng_seed("wide", 0);
+    int numFiles = 20000 * scale;
+    for (int f = 0; f < numFiles; f++) {
+        snprintf(path, sizeof(path), "%s/file%06d.dat", root, f);
+        write_file(AT_FDCWD, path, (long long) (rng_next(&r) % 256), &r);
+    }
+}
+
+// Many distinct extensions, to stress the extension table.
+static void gen_exts(const char *root, int scale) {
+    char path[PATH_MAX];
+    Rng r = rng_seed("exts", 0);
+    int numDirs = 20 * scale;
+    for (int d = 0; d < numDirs; d++) {
+        snprintf(path, sizeof(path), "%s/d%03d", root, d);
+        make_dir(AT_FDCWD, path);
+        for (int f = 0; f < 250; f++) {
+            unsigned ext = (unsigned) (rng_next(&r) % 1000);
+            snprintf(path, sizeof(path), "%s/d%03d/f%03d.x%03u", root, d, f, ext);
+            write_file(AT_FDCWD, path, (long long) (rng_next(&r) % 2048), &r);
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*generate)(const char *root, int scale);
+} TreeShape;
+
+static const TreeShape shapes[] = {
+    {"tiny", gen_tiny},
+    {"huge", gen_huge},
+    {"deep", gen_deep},
+    {"wide", gen_wide},
+    {"exts", gen_exts},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <dir> [scale]\n", argv[0]);
+        return 1;
+    }
+    const char *dir = argv[1];
+    int scale = argc == 3 ? atoi(argv[2]) : 1;
+    if (scale < 1)
+        scale = 1;
+
+    char stamp[PATH_MAX], want[64], have[64] = "";
+    snprintf(stamp, sizeof(stamp), "%s/" STAMP_NAME, dir);
+    snprintf(want, sizeof(want), "gentree %d scale %d\n", GENTREE_VERSION, scale);
+    FILE *f = fopen(stamp, "r");
+    if (f) {
+        if (!fgets(have, sizeof(have), f))
+            have[0] = '\0';
+        fclose(f);
+    }
+    if (strcmp(have, want) == 0)
+        return 0;
+    if (have[0] != '\0') {
+        fprintf(stderr, "gentree: %s was generated with different parameters; remove it first\n", dir);
+        return 1;
+    }
+
+    make_dir(AT_FDCWD, dir);
+    for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+        char root[PATH_MAX];
+        snprintf(root, sizeof(root), "%s/%s", dir, shapes[i].name);
+        fprintf(stderr, "gentree: generating %s\n", root);
+        make_dir(AT_FDCWD, root);
+        shapes[i].generate(root, scale);
+    }
+
+    f = fopen(stamp, "w");
+    if (!f || fputs(want, f) == EOF || fclose(f) != 0) {
+        perror(stamp);
+        return 1;
+    }
+    return 0;
+}
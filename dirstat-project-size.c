@@ -1,12 +1,21 @@
+#define _GNU_SOURCE
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <strings.h>  // for strcasecmp
 #include <limits.h>   // for PATH_MAX
-#include <ctype.h>    // for isdigit() and tolower()
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>  // for raising RLIMIT_NOFILE
+#include "libdirstat.h"
+
+// ---------------------------------------------------------------------------
+// dirstat-project-size: the command-line client of libdirstat. It turns the
+// options into a DirstatOptions, runs the scan and prints the results.
+// ---------------------------------------------------------------------------
 
 // ANSI escape definitions
 #define ANSI_RESET   "\033[0m"
@@ -17,111 +26,64 @@
 #define MAX_BAR_LENGTH 20
 #define NUM_STOPS 3  // Number of gradient stops for the bar
 
+// --watch: default seconds between updates
+#define WATCH_DEFAULT_INTERVAL 2.0
+
+// Several roots: extensions with a column of their own in the extension mix
+#define MIX_COLUMNS 6
+
+// --duplicates: groups listed in the table, and paths listed per group
+#define DUP_GROUPS_SHOWN 10
+#define DUP_PATHS_SHOWN 5
+
 // Global flags
 int useColor = 1;
 int toggleAscii = 0;   // When true, use ASCII '#' for filled and '-' for empty
 int onlyBarColor = 0;  // When true, text is not colored except the bars
+int estimateMode = 0;    // Sizes from metadata, lines from a sample (--estimate)
+int binaryDetect = 1;    // Count binary files by size only (off: --no-binary-detect)
+int classifyLines = 0;   // Split lines into code, comment and blank (--classify)
+int findDuplicates = 0;  // Report files with identical contents (--duplicates)
+int topDirs = 0;         // Largest directories to list (--top=N)
+int treeDepth = -1;      // Levels of the directory tree to print (--depth=D), -1: none
+DirstatTreeKey treeKey = DIRSTAT_TREE_BY_BYTES;   // what --top ranks and --depth sorts by (--top-by=)
+int batchMode = 0;       // Several roots (or --roots-from): one comparison report
 
+// Output format of the results (--format=)
+typedef enum {
+    FORMAT_TABLE = 0,   // colored table (default)
+    FORMAT_JSON,        // one JSON document
+    FORMAT_NDJSON,      // one JSON record per line, streamed
+    FORMAT_CSV
+} OutputFormat;
 
+OutputFormat outputFormat = FORMAT_TABLE;
 
-// ---------------------------------------------------------------------------
-// Structures
-// ---------------------------------------------------------------------------
-typedef struct {
-    long long bytes;   // total bytes
-    long long lines;   // total lines (number of '\n')
-    long long chars;   // total characters read
-} FileStats;
-
-typedef struct {
-    long numFiles;
-    long numDirs;
-    FileStats stats;
-} ProjectStats;
-
-typedef struct {
-    char ext[64];      // file extension (e.g., "c", "cpp", "py")
-    long count;
-} ExtCount;
+DirstatSortType sortType = DIRSTAT_SORT_DESCENDING;
+int caseSensitive = 0;  // 0 for case-insensitive, 1 for case-sensitive
 
 
 
 // ---------------------------------------------------------------------------
 // Function Declarations
 // ---------------------------------------------------------------------------
-FileStats get_file_stats(const char *filepath);
-void update_extension_counts(const char *filename, ExtCount **extCounts, int *extCount, int *extCapacity);
-void process_path(const char *path, ProjectStats *projStats, ExtCount **extCounts, int *extCount, int *extCapacity, const char **excludes, int num_excludes);
-int compare_ext_desc(const void *a, const void *b);
+void output_begin(const char *root);
+void output_directory(void *user, const char *path, const DirstatDirTotals *totals);
+void output_end(const char *root, const DirstatProjectStats *projStats, const DirstatExtCount *extCounts, int extCount,
+                double linesCi, const DirstatDupGroup *dups, int numDups);
+void print_duplicates(const DirstatDupGroup *dups, int numDups, const DirstatExtCount *extCounts, int extCount,
+                      const char *headerColor, const char *resetColor);
+void print_top_dirs(const Dirstat *ds, int n, const char *headerColor, const char *resetColor);
+void print_dir_tree(const DirstatTreeDir *root, int maxDepth, const char *headerColor, const char *resetColor);
+int watch_render(Dirstat *ds, void *root);
+void print_comparison(const char **roots, Dirstat **scans, int numRoots);
+int output_batch(const char **roots, Dirstat **scans, int numRoots);
+void print_statistics(const char *root, const DirstatProjectStats *projStats, const DirstatExtCount *extCounts,
+                      int extCount, double linesCi);
 void print_bar(double percentage, const char *color);
 void get_gradient_color(int rank, int total, char *buffer, size_t buflen);
-int is_excluded(const char *path, const char **excludes, int num_excludes);
 void print_help(void);
 
-
-// Add to global variables
-typedef enum {
-    SORT_DESCENDING = 0,    // Default
-    SORT_ASCENDING,
-    SORT_ALPHA_ASC,
-    SORT_ALPHA_DESC,
-    SORT_NUM_ASC,
-    SORT_NUM_DESC,
-    SORT_NATURAL_ASC,
-    SORT_NATURAL_DESC,
-    SORT_SIZE_ASC,
-    SORT_SIZE_DESC
-} SortType;
-
-SortType sortType = SORT_DESCENDING;
-int caseSensitive = 0;  // 0 for case-insensitive, 1 for case-sensitive
-
-// New comparison functions
-int compare_ext_asc(const void *a, const void *b) {
-    const ExtCount *ea = (const ExtCount*) a;
-    const ExtCount *eb = (const ExtCount*) b;
-    return caseSensitive ? strcmp(ea->ext, eb->ext) : strcasecmp(ea->ext, eb->ext);
-}
-
-int compare_ext_num_asc(const void *a, const void *b) {
-    const ExtCount *ea = (const ExtCount*) a;
-    const ExtCount *eb = (const ExtCount*) b;
-    if (ea->count == eb->count)
-        return caseSensitive ? strcmp(ea->ext, eb->ext) : strcasecmp(ea->ext, eb->ext);
-    return (ea->count > eb->count) ? 1 : -1;
-}
-
-int compare_ext_num_desc(const void *a, const void *b) {
-    return compare_ext_num_asc(b, a);
-}
-
-// Simple natural sort comparison (basic implementation)
-int strnatcmp(const char *a, const char *b) {
-    while (*a && *b) {
-        if (isdigit(*a) && isdigit(*b)) {
-            long na = 0, nb = 0;
-            while (isdigit(*a)) na = na * 10 + (*a++ - '0');
-            while (isdigit(*b)) nb = nb * 10 + (*b++ - '0');
-            if (na != nb) return (na > nb) ? 1 : -1;
-        } else {
-            if (tolower(*a) != tolower(*b))
-                return caseSensitive ? (*a - *b) : (tolower(*a) - tolower(*b));
-            a++; b++;
-        }
-    }
-    return caseSensitive ? (*a - *b) : (tolower(*a) - tolower(*b));
-}
-
-int compare_ext_natural_asc(const void *a, const void *b) {
-    const ExtCount *ea = (const ExtCount*) a;
-    const ExtCount *eb = (const ExtCount*) b;
-    return strnatcmp(ea->ext, eb->ext);
-}
-
-int compare_ext_natural_desc(const void *a, const void *b) {
-    return strnatcmp(((const ExtCount*)b)->ext, ((const ExtCount*)a)->ext);
-}
-
 // ---------------------------------------------------------------------------
 // Print help message and exit.
 // ---------------------------------------------------------------------------
@@ -145,13 +107,40 @@ int compare_ext_natural_desc(const void *a, const void *b) {
 
 // Modified print_help function
 void print_help(void) {
-    printf("Usage: dirstat-project-size [directory] [options]\n");
+    printf("Usage: dirstat-project-size [directory...] [options]\n");
     printf("Options:\n");
     printf("  -h, --help           Display this help message\n");
     printf("  --no-color          Disable colorized output\n");
     printf("  --toggle-ascii      Use ASCII instead of Unicode blocks\n");
     printf("  --only-bar-color    Color only bars, not text\n");
-    printf("  --exclude=pattern   Exclude paths containing pattern\n");
+    printf("  --exclude=pattern   Exclude paths containing pattern (glob if it has * ? or [)\n");
+    printf("  --gitignore         Skip whatever .gitignore files (and .git) would ignore\n");
+    printf("  --git               Count only the files tracked in the directory's .git/index\n");
+    printf("  --watch[=SECONDS]   Keep the statistics updated as files change, at most every SECONDS (default 2)\n");
+    printf("  --follow-symlinks   Follow symlinks below the directory (default)\n");
+    printf("  --no-follow-symlinks  Skip symlinks below the directory\n");
+    printf("  -x, --one-file-system  Do not descend into other file systems\n");
+    printf("  --count-hardlinks   Count every hard link to a file (default)\n");
+    printf("  --dedup-hardlinks   Count a file reached by several hard links or symlinks only once\n");
+    printf("  --jobs=N            Scan with N worker threads (0 = one per CPU)\n");
+    printf("  --io=sync|mmap|uring  I/O backend used to read file contents\n");
+    printf("  --format=table|json|ndjson|csv  Output format; ndjson streams per-directory records\n");
+    printf("  --binary-ext=LIST   Also count these extensions as binary (comma-separated)\n");
+    printf("  --no-binary-detect  Count lines in every file, binary or not\n");
+    printf("  --classify          Split the lines of known languages into code, comment and blank\n");
+    printf("  --duplicates        Report files with identical contents and the bytes their copies waste\n");
+    printf("  --top=N             List the N largest directories (table output)\n");
+    printf("  --depth=D           Print the directory tree D levels deep (table output)\n");
+    printf("  --top-by=bytes|lines|files  What --top and --depth rank directories by\n");
+    printf("  --estimate[=PCT]    Sizes from metadata, lines estimated from a PCT%% sample (default 2)\n");
+    printf("  --profile           Print where the scan spent its time after the statistics\n");
+    printf("  --profile=json      Same, as one JSON object on stderr\n");
+    printf("  --cache             Reuse the counts of unchanged files from a scan cache in ~/.cache/dirstat\n");
+    printf("  --no-cache          Do not read or write the scan cache (default)\n");
+    printf("  --rebuild-cache     Ignore the existing scan cache and write a fresh one\n");
+    printf("  --cache-file=path   Keep the scan cache at path instead of ~/.cache/dirstat\n");
+    printf("  --roots-from=FILE   Also scan the directories listed in FILE, one per line (- for stdin)\n");
+    printf("Several directories are scanned together and compared in one report.\n");
     printf("Sorting Options:\n");
     printf("  --sort-descending   Sort by count descending (default)\n");
     printf("  --sort-ascending    Sort by count ascending\n");
@@ -161,128 +150,529 @@ void print_help(void) {
     printf("  --sort-num-desc     Sort numerically descending\n");
     printf("  --sort-natural-asc  Sort with natural ordering ascending\n");
     printf("  --sort-natural-desc Sort with natural ordering descending\n");
+    printf("  --sort-size-asc     Sort by total size ascending\n");
+    printf("  --sort-size-desc    Sort by total size descending\n");
     printf("  --case-sensitive    Make alphabetical sorting case-sensitive\n");
     printf("\nExamples:\n");
     printf("  dirstat-project-size /path/to/project --sort-alpha-asc\n");
     printf("  dirstat-project-size --sort-natural-desc --case-sensitive\n");
+    printf("  dirstat-project-size ~/src/* --jobs=8\n");
     exit(0);
 }
 
+
 // ---------------------------------------------------------------------------
-// Check if the given path matches any of the exclude patterns.
+// Make room for at least `needed` elements in a realloc'ed array
 // ---------------------------------------------------------------------------
-int is_excluded(const char *path, const char **excludes, int num_excludes) {
-    for (int i = 0; i < num_excludes; i++) {
-        if (strstr(path, excludes[i]) != NULL)
-            return 1;
+static void *grow_array(void *array, size_t *capacity, size_t needed, size_t elemSize) {
+    if (needed <= *capacity)
+        return array;
+    size_t newCapacity = (*capacity == 0) ? 256 : *capacity;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    array = realloc(array, newCapacity * elemSize);
+    if (!array) {
+        perror("realloc");
+        exit(1);
     }
-    return 0;
+    *capacity = newCapacity;
+    return array;
 }
 
 // ---------------------------------------------------------------------------
-// Count lines & characters for a single file
+// Parse the value of a numeric --option=VALUE; anything that is not a number
+// in [min, max] is an error.
 // ---------------------------------------------------------------------------
-FileStats get_file_stats(const char *filepath) {
-    FileStats s = {0, 0, 0};
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp)
-        return s;
-    int c;
-    while ((c = fgetc(fp)) != EOF) {
-        s.bytes++;
-        s.chars++;
-        if (c == '\n')
-            s.lines++;
-    }
-    fclose(fp);
-    return s;
+static double parse_number_option(const char *option, const char *value, double min, double max) {
+    char *end;
+    errno = 0;
+    double v = strtod(value, &end);
+    if (end == value || *end != '\0' || errno == ERANGE || !(v >= min && v <= max)) {
+        fprintf(stderr, "%s expects a number between %g and %g, not '%s'\n", option, min, max, value);
+        exit(1);
+    }
+    return v;
+}
+
+static int parse_int_option(const char *option, const char *value, int min, int max) {
+    char *end;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || errno == ERANGE || v < min || v > max) {
+        fprintf(stderr, "%s expects a whole number between %d and %d, not '%s'\n", option, min, max, value);
+        exit(1);
+    }
+    return (int) v;
 }
 
 // ---------------------------------------------------------------------------
-// Update dynamic extension count list based on filename
+// Machine-readable output (--format=json|ndjson|csv).
+// Directory records are written as soon as a subtree is finished, from
+// whichever thread finishes it; the extension and total records follow at
+// the end. json wraps the same records in one document:
+//   {"root":..., "directories":[...], "extensions":[...], "totals":{...}}
+// With several roots there are no directory records; every root gets its
+// extension and total records, csv rows start with a root column, ndjson
+// extension records carry a "root" and json holds one document per root:
+//   {"roots":[{"root":..., "extensions":[...], "totals":{...}}, ...]}
 // ---------------------------------------------------------------------------
-void update_extension_counts(const char *filename, ExtCount **extCounts, int *extCount, int *extCapacity) {
-    const char *dot = strrchr(filename, '.');
-    char extension[64];
-    if (dot && dot != filename) {
-        strncpy(extension, dot + 1, sizeof(extension));
-        extension[sizeof(extension) - 1] = '\0';
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+static long outputRecords;   // directory records written so far
+
+// Write `s` as a CSV field, quoted when it contains a separator or quote.
+static void csv_print_field(FILE *out, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        fputs(s, out);
+        return;
+    }
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// Start a csv row of `root`'s records: with several roots, the root column.
+static void csv_begin_row(const char *root) {
+    if (batchMode) {
+        csv_print_field(stdout, root);
+        putchar(',');
+    }
+}
+
+void output_begin(const char *root) {
+    if (outputFormat == FORMAT_JSON && batchMode) {
+        printf("{\"roots\":[");
+    } else if (outputFormat == FORMAT_JSON) {
+        printf("{\"root\":");
+        dirstat_json_print_string(stdout, root);
+        printf(",\"directories\":[");
+    } else if (outputFormat == FORMAT_CSV) {
+        printf("%stype,name,files,dirs,bytes,lines,chars%s%s%s\n", batchMode ? "root," : "",
+               estimateMode ? ",lines_ci95" : "", classifyLines ? ",code,comment,blank" : "",
+               findDuplicates ? ",dup_files,dup_bytes,dup_group" : "");
+    }
+}
+
+// The directory hook: called from the walker threads as subtrees finish.
+void output_directory(void *user, const char *path, const DirstatDirTotals *totals) {
+    const DirstatDirTotals *t = totals;
+    (void) user;
+    pthread_mutex_lock(&outputLock);
+    if (outputFormat == FORMAT_CSV) {
+        printf("dir,");
+        csv_print_field(stdout, path);
+        if (estimateMode)
+            printf(",%ld,%ld,%lld,,%lld,%s\n", t->files, t->dirs, t->bytes, t->chars, findDuplicates ? ",,," : "");
+        else
+            printf(",%ld,%ld,%lld,%lld,%lld%s%s\n", t->files, t->dirs, t->bytes, t->lines, t->chars,
+                   classifyLines ? ",,," : "", findDuplicates ? ",,," : "");
     } else {
-        strcpy(extension, "no_ext");
+        if (outputFormat == FORMAT_JSON && outputRecords > 0)
+            putchar(',');
+        printf(outputFormat == FORMAT_NDJSON ? "{\"type\":\"dir\",\"path\":" : "{\"path\":");
+        dirstat_json_print_string(stdout, path);
+        printf(",\"files\":%ld,\"dirs\":%ld,\"bytes\":%lld,\"lines\":", t->files, t->dirs, t->bytes);
+        if (estimateMode)
+            printf("null");   // only known for the whole tree and per extension
+        else
+            printf("%lld", t->lines);
+        printf(",\"chars\":%lld}", t->chars);
+        if (outputFormat == FORMAT_NDJSON) {
+            putchar('\n');
+            fflush(stdout);
+        }
+    }
+    outputRecords++;
+    pthread_mutex_unlock(&outputLock);
+}
+
+// Extension, duplicate and total records, after the scan has finished. With
+// --estimate they also carry the 95% confidence half-width of the line
+// counts; with --duplicates every file of a group is a csv row of its own,
+// its copies counted in dup_files and dup_bytes.
+void output_end(const char *root, const DirstatProjectStats *projStats, const DirstatExtCount *extCounts, int extCount,
+                double linesCi, const DirstatDupGroup *dups, int numDups) {
+    const DirstatFileStats *t = &projStats->stats;
+    long dupFiles = 0;
+    long long dupBytes = 0;
+    for (int i = 0; i < numDups; i++) {
+        dupFiles += dups[i].count - 1;
+        dupBytes += dups[i].size * (dups[i].count - 1);
+    }
+    if (outputFormat == FORMAT_JSON && batchMode) {
+        printf("{\"root\":");
+        dirstat_json_print_string(stdout, root);
+        printf(",\"extensions\":[");
+    } else if (outputFormat == FORMAT_JSON) {
+        printf("],\"extensions\":[");
+    }
+    for (int i = 0; i < extCount; i++) {
+        const DirstatExtCount *e = &extCounts[i];
+        if (outputFormat == FORMAT_CSV) {
+            csv_begin_row(root);
+            printf("ext,");
+            csv_print_field(stdout, e->ext);
+            printf(",%ld,,%lld,%lld,%lld", e->count, e->bytes, e->lines, e->chars);
+            if (estimateMode)
+                printf(",%.0f", e->linesCi);
+            if (classifyLines && e->language)
+                printf(",%lld,%lld,%lld", e->codeLines, e->commentLines, e->blankLines);
+            else if (classifyLines)
+                printf(",,,");
+            if (findDuplicates)
+                printf(",%ld,%lld,", e->dupFiles, e->dupBytes);
+            putchar('\n');
+            continue;
+        }
+        if (outputFormat == FORMAT_NDJSON && batchMode) {
+            printf("{\"type\":\"ext\",\"root\":");
+            dirstat_json_print_string(stdout, root);
+            printf(",\"ext\":");
+        } else {
+            printf(outputFormat == FORMAT_NDJSON ? "{\"type\":\"ext\",\"ext\":" : "%s{\"ext\":", i ? "," : "");
+        }
+        dirstat_json_print_string(stdout, e->ext);
+        printf(",\"files\":%ld,\"bytes\":%lld,\"lines\":%lld,\"chars\":%lld", e->count, e->bytes, e->lines,
+               e->chars);
+        if (estimateMode)
+            printf(",\"lines_ci95\":%.0f", e->linesCi);
+        if (classifyLines && e->language) {
+            printf(",\"language\":");
+            dirstat_json_print_string(stdout, e->language);
+            printf(",\"code\":%lld,\"comment\":%lld,\"blank\":%lld", e->codeLines, e->commentLines, e->blankLines);
+        } else if (classifyLines) {
+            printf(",\"language\":null,\"code\":null,\"comment\":null,\"blank\":null");
+        }
+        if (findDuplicates)
+            printf(",\"dup_files\":%ld,\"dup_bytes\":%lld", e->dupFiles, e->dupBytes);
+        printf("}%s", outputFormat == FORMAT_NDJSON ? "\n" : "");
     }
-    for (int i = 0; i < *extCount; i++) {
-        if (strcmp((*extCounts)[i].ext, extension) == 0) {
-            (*extCounts)[i].count++;
-            return;
+    if (outputFormat == FORMAT_JSON && findDuplicates)
+        printf("],\"duplicates\":[");
+    for (int i = 0; i < numDups; i++) {
+        const DirstatDupGroup *g = &dups[i];
+        if (outputFormat == FORMAT_CSV) {
+            for (int p = 0; p < g->count; p++) {
+                csv_begin_row(root);
+                printf("dup,");
+                csv_print_field(stdout, g->paths[p]);
+                printf(",1,,%lld,,%s%s,%d,%lld,%d\n", g->size, estimateMode ? "," : "", classifyLines ? ",,," : "",
+                       p > 0, p > 0 ? g->size : 0, i + 1);
+            }
+            continue;
         }
+        if (outputFormat == FORMAT_NDJSON && batchMode) {
+            printf("{\"type\":\"dup\",\"root\":");
+            dirstat_json_print_string(stdout, root);
+            putchar(',');
+        } else {
+            printf(outputFormat == FORMAT_NDJSON ? "{\"type\":\"dup\"," : "%s{", i ? "," : "");
+        }
+        printf("\"size\":%lld,\"files\":%d,\"wasted_bytes\":%lld,\"paths\":[", g->size, g->count,
+               g->size * (g->count - 1));
+        for (int p = 0; p < g->count; p++) {
+            if (p > 0)
+                putchar(',');
+            dirstat_json_print_string(stdout, g->paths[p]);
+        }
+        printf("]}%s", outputFormat == FORMAT_NDJSON ? "\n" : "");
     }
-    if (*extCount >= *extCapacity) {
-        *extCapacity = (*extCapacity == 0) ? 8 : (*extCapacity * 2);
-        *extCounts = realloc(*extCounts, (*extCapacity) * sizeof(ExtCount));
-        if (!*extCounts) {
-            perror("realloc");
-            exit(1);
+    if (outputFormat == FORMAT_CSV) {
+        // The binary files' share of the totals, as a record of its own
+        if (binaryDetect) {
+            csv_begin_row(root);
+            printf("binary,");
+            csv_print_field(stdout, root);
+            printf(",%lld,,%lld,0,0%s%s%s\n", t->binaryFiles, t->binaryBytes, estimateMode ? ",0" : "",
+                   classifyLines ? ",0,0,0" : "", findDuplicates ? ",,," : "");
         }
+        csv_begin_row(root);
+        printf("total,");
+        csv_print_field(stdout, root);
+        printf(",%ld,%ld,%lld,%lld,%lld", projStats->numFiles, projStats->numDirs, t->bytes, t->lines, t->chars);
+        if (estimateMode)
+            printf(",%.0f", linesCi);
+        if (classifyLines)
+            printf(",%lld,%lld,%lld", t->codeLines, t->commentLines, t->blankLines);
+        if (findDuplicates)
+            printf(",%ld,%lld,", dupFiles, dupBytes);
+        putchar('\n');
+        return;
+    }
+    if (outputFormat == FORMAT_NDJSON) {
+        printf("{\"type\":\"total\",\"root\":");
+        dirstat_json_print_string(stdout, root);
+        putchar(',');
+    } else {
+        printf("],\"totals\":{");
+    }
+    printf("\"files\":%ld,\"dirs\":%ld,\"bytes\":%lld,\"lines\":%lld,\"chars\":%lld", projStats->numFiles,
+           projStats->numDirs, t->bytes, t->lines, t->chars);
+    if (binaryDetect)
+        printf(",\"binary_files\":%lld,\"binary_bytes\":%lld", t->binaryFiles, t->binaryBytes);
+    if (estimateMode)
+        printf(",\"lines_ci95\":%.0f,\"estimated\":true", linesCi);
+    if (classifyLines)
+        printf(",\"code\":%lld,\"comment\":%lld,\"blank\":%lld", t->codeLines, t->commentLines, t->blankLines);
+    if (findDuplicates)
+        printf(",\"dup_files\":%ld,\"dup_groups\":%d,\"dup_bytes\":%lld", dupFiles, numDups, dupBytes);
+    if (outputFormat == FORMAT_JSON && batchMode)
+        printf("}}");   // the next root or the end of the roots follows
+    else
+        printf("}%s\n", outputFormat == FORMAT_JSON ? "}" : "");
+}
+
+static const char *tree_key_name(void) {
+    return treeKey == DIRSTAT_TREE_BY_LINES ? "lines" : treeKey == DIRSTAT_TREE_BY_FILES ? "files" : "size";
+}
+
+// Write the path of `d` from the root node's path down.
+static void tree_print_path(const DirstatTreeDir *d) {
+    const DirstatTreeDir *chain[256];
+    int n = 0;
+    for (; d && n < (int) (sizeof(chain) / sizeof(chain[0])); d = d->parent)
+        chain[n++] = d;
+    if (d)
+        fputs(".../", stdout);   // deeper than the chain buffer: elide the top
+    for (int i = n - 1; i >= 0; i--)
+        printf("%s%s", chain[i]->name, i ? "/" : "");
+}
+
+static void tree_print_row(const DirstatTreeDir *d, const char *indent) {
+    char sizeDisplay[16], linesDisplay[24];
+    dirstat_format_size(d->bytes, sizeDisplay, sizeof(sizeDisplay));
+    if (estimateMode)
+        snprintf(linesDisplay, sizeof(linesDisplay), "-");   // not estimated per directory
+    else
+        snprintf(linesDisplay, sizeof(linesDisplay), "%lld", d->lines);
+    printf("%10s %12s %8ld   %s", sizeDisplay, linesDisplay, d->files, indent);
+}
+
+// --top=N: the N largest directories below the root
+void print_top_dirs(const Dirstat *ds, int n, const char *headerColor, const char *resetColor) {
+    const DirstatTreeDir **top = malloc((size_t) n * sizeof(DirstatTreeDir *));
+    if (!top) {
+        perror("malloc");
+        exit(1);
+    }
+    int size = dirstat_top_dirs(ds, treeKey, n, top);
+    printf("\n%sLargest directories by %s:%s\n", headerColor, tree_key_name(), resetColor);
+    printf("%10s %12s %8s   %s\n", "Size", "Lines", "Files", "Directory");
+    printf("-------------------------------------------------------------------------------\n");
+    for (int i = 0; i < size; i++) {
+        tree_print_row(top[i], "");
+        tree_print_path(top[i]);
+        putchar('\n');
+    }
+    free(top);
+}
+
+static void print_tree_level(const DirstatTreeDir *d, int level, int maxDepth) {
+    char indent[2 * 64 + 1];
+    int width = level < 64 ? 2 * level : 128;
+    memset(indent, ' ', (size_t) width);
+    indent[width] = '\0';
+    tree_print_row(d, indent);
+    printf("%s%s\n", d->name, level > 0 ? "/" : "");
+    if (level >= maxDepth || !d->firstChild)
+        return;
+    size_t n = 0;
+    for (const DirstatTreeDir *c = d->firstChild; c; c = c->nextSibling)
+        n++;
+    const DirstatTreeDir **children = malloc(n * sizeof(DirstatTreeDir *));
+    if (!children) {
+        perror("malloc");
+        exit(1);
     }
-    strncpy((*extCounts)[*extCount].ext, extension, sizeof((*extCounts)[*extCount].ext));
-    (*extCounts)[*extCount].ext[sizeof((*extCounts)[*extCount].ext) - 1] = '\0';
-    (*extCounts)[*extCount].count = 1;
-    (*extCount)++;
+    n = 0;
+    for (const DirstatTreeDir *c = d->firstChild; c; c = c->nextSibling)
+        children[n++] = c;
+    dirstat_sort_dirs(children, n, treeKey);
+    for (size_t i = 0; i < n; i++)
+        print_tree_level(children[i], level + 1, maxDepth);
+    free(children);
+}
+
+// --depth=D: subtree totals of every directory down to D levels below the
+// root, largest first among siblings.
+void print_dir_tree(const DirstatTreeDir *root, int maxDepth, const char *headerColor, const char *resetColor) {
+    printf("\n%sDirectory tree (%d level%s, by %s):%s\n", headerColor, maxDepth, maxDepth == 1 ? "" : "s",
+           tree_key_name(), resetColor);
+    printf("%10s %12s %8s   %s\n", "Size", "Lines", "Files", "Directory");
+    printf("-------------------------------------------------------------------------------\n");
+    print_tree_level(root, 0, maxDepth);
+}
+
+// --watch: print the statistics again after every update.
+int watch_render(Dirstat *ds, void *root) {
+    int extCount = 0;
+    DirstatExtCount *extCounts = dirstat_extensions(ds, sortType, caseSensitive, &extCount);
+    if (outputFormat == FORMAT_TABLE) {
+        if (isatty(STDOUT_FILENO))
+            printf("\033[H\033[2J");   // redraw in place
+        print_statistics(root, dirstat_totals(ds), extCounts, extCount, 0);
+        char when[16];
+        time_t now = time(NULL);
+        strftime(when, sizeof(when), "%H:%M:%S", localtime(&now));
+        printf("\nWatching for changes (updated %s)\n", when);
+    } else {
+        output_begin(root);
+        output_end(root, dirstat_totals(ds), extCounts, extCount, 0, NULL, 0);
+    }
+    fflush(stdout);
+    free(extCounts);
+    return 0;
 }
 
 // ---------------------------------------------------------------------------
-// Recursively process a file or directory path.
-// Excludes any path containing one of the provided patterns.
+// Several roots: the records of every root in turn (--format=json|ndjson|csv).
+// A root that could not be scanned has no records, nor do the duplicates of a
+// root that ran out of memory finding them; returns how many of those there were.
 // ---------------------------------------------------------------------------
-void process_path(const char *path, ProjectStats *projStats, ExtCount **extCounts, int *extCount, int *extCapacity, const char **excludes, int num_excludes) {
-    if (is_excluded(path, excludes, num_excludes))
-        return;
-    struct stat st;
-    if (stat(path, &st) != 0)
-        return;
-    if (S_ISREG(st.st_mode)) {
-        projStats->numFiles++;
-        FileStats fstats = get_file_stats(path);
-        projStats->stats.bytes += fstats.bytes;
-        projStats->stats.lines += fstats.lines;
-        projStats->stats.chars += fstats.chars;
-        const char *filename = strrchr(path, '/');
-        if (filename)
-            filename++; // Skip '/'
-        else
-            filename = path;
-        update_extension_counts(filename, extCounts, extCount, extCapacity);
-    } else if (S_ISDIR(st.st_mode)) {
-        projStats->numDirs++;
-        DIR *dir = opendir(path);
-        if (!dir)
-            return;
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                continue;
-            char subpath[2048];
-            snprintf(subpath, sizeof(subpath), "%s/%s", path, entry->d_name);
-            process_path(subpath, projStats, extCounts, extCount, extCapacity, excludes, num_excludes);
+int output_batch(const char **roots, Dirstat **scans, int numRoots) {
+    output_begin(NULL);
+    int written = 0;
+    int dupFailed = 0;
+    for (int i = 0; i < numRoots; i++) {
+        if (!scans[i])
+            continue;
+        if (outputFormat == FORMAT_JSON && written++ > 0)
+            putchar(',');
+        int extCount = 0;
+        DirstatExtCount *extCounts = dirstat_extensions(scans[i], sortType, caseSensitive, &extCount);
+        int numDups = 0;
+        const DirstatDupGroup *dups = dirstat_duplicates(scans[i], &numDups);
+        if (numDups < 0) {
+            fprintf(stderr, "%s: --duplicates: out of memory, no duplicates reported\n", roots[i]);
+            numDups = 0;
+            dupFailed++;
         }
-        closedir(dir);
+        output_end(roots[i], dirstat_totals(scans[i]), extCounts, extCount, dirstat_lines_ci(scans[i]), dups,
+                   numDups);
+        free(extCounts);
     }
+    if (outputFormat == FORMAT_JSON)
+        printf("]}\n");
+    return dupFailed;
+}
+
+typedef struct {
+    const char *ext;
+    long count;
+} MixEntry;
+
+static int compare_mix_ext(const void *a, const void *b) {
+    return strcmp(((const MixEntry *) a)->ext, ((const MixEntry *) b)->ext);
+}
+
+static int compare_mix_count(const void *a, const void *b) {
+    const MixEntry *ma = a, *mb = b;
+    if (ma->count != mb->count)
+        return ma->count < mb->count ? 1 : -1;
+    return strcmp(ma->ext, mb->ext);
+}
+
+static void print_comparison_row(const char *sizeDisplay, const char *linesDisplay, const char *files,
+                                 const char *dirs, const char *root) {
+    printf("%10s %12s %8s %8s   %s\n", sizeDisplay, linesDisplay, files, dirs, root);
 }
 
 // ---------------------------------------------------------------------------
-// Comparison function for sorting extensions in descending order (highest % first)
+// Several roots, table output: the totals of each root side by side, then
+// the extension mix: every root's share of files in the extensions that are
+// most common over all roots.
 // ---------------------------------------------------------------------------
-int compare_ext_desc(const void *a, const void *b) {
-    const ExtCount *ea = (const ExtCount*) a;
-    const ExtCount *eb = (const ExtCount*) b;
-    if (ea->count < eb->count)
-        return 1;
-    else if (ea->count > eb->count)
-        return -1;
-    else
-        return strcmp(ea->ext, eb->ext);
-}
+void print_comparison(const char **roots, Dirstat **scans, int numRoots) {
+    const char *headerColor = (useColor && !onlyBarColor) ? (ANSI_BOLD "\033[38;2;101;152;75m") : "";
+    const char *resetColor = useColor ? ANSI_RESET : "";
+    char sizeDisplay[16], linesDisplay[24], files[24], dirs[24];
+    DirstatProjectStats total = {0};
+    MixEntry *mix = NULL;
+    size_t numMix = 0, capMix = 0;
+
+    printf("\n%sComparison of %d roots:%s\n", headerColor, numRoots, resetColor);
+    print_comparison_row("Size", "Lines", "Files", "Dirs", "Root");
+    printf("-------------------------------------------------------------------------------\n");
+    for (int i = 0; i < numRoots; i++) {
+        if (!scans[i]) {
+            print_comparison_row("-", "-", "-", "-", roots[i]);
+            continue;
+        }
+        const DirstatProjectStats *p = dirstat_totals(scans[i]);
+        total.numFiles += p->numFiles;
+        total.numDirs += p->numDirs;
+        total.stats.bytes += p->stats.bytes;
+        total.stats.lines += p->stats.lines;
+        dirstat_format_size(p->stats.bytes, sizeDisplay, sizeof(sizeDisplay));
+        snprintf(linesDisplay, sizeof(linesDisplay), "%s%lld", estimateMode ? "~" : "", p->stats.lines);
+        snprintf(files, sizeof(files), "%ld", p->numFiles);
+        snprintf(dirs, sizeof(dirs), "%ld", p->numDirs);
+        print_comparison_row(sizeDisplay, linesDisplay, files, dirs, roots[i]);
+
+        int extCount = 0;
+        DirstatExtCount *extCounts = dirstat_extensions(scans[i], DIRSTAT_SORT_DESCENDING, 0, &extCount);
+        mix = grow_array(mix, &capMix, numMix + (size_t) extCount, sizeof(MixEntry));
+        for (int e = 0; e < extCount; e++)
+            mix[numMix++] = (MixEntry){extCounts[e].ext, extCounts[e].count};
+        // The names stay valid as long as the scan does.
+        free(extCounts);
+    }
+    printf("-------------------------------------------------------------------------------\n");
+    dirstat_format_size(total.stats.bytes, sizeDisplay, sizeof(sizeDisplay));
+    snprintf(linesDisplay, sizeof(linesDisplay), "%s%lld", estimateMode ? "~" : "", total.stats.lines);
+    snprintf(files, sizeof(files), "%ld", total.numFiles);
+    snprintf(dirs, sizeof(dirs), "%ld", total.numDirs);
+    print_comparison_row(sizeDisplay, linesDisplay, files, dirs, "Total");
 
+    // Sum the file counts per extension over all roots, then keep the largest.
+    size_t numExts = 0;
+    if (numMix > 0)
+        qsort(mix, numMix, sizeof(MixEntry), compare_mix_ext);
+    for (size_t i = 0; i < numMix; i++) {
+        if (numExts > 0 && strcmp(mix[numExts - 1].ext, mix[i].ext) == 0)
+            mix[numExts - 1].count += mix[i].count;
+        else
+            mix[numExts++] = mix[i];
+    }
+    if (numExts > 0)
+        qsort(mix, numExts, sizeof(MixEntry), compare_mix_count);
+    int columns = numExts < MIX_COLUMNS ? (int) numExts : MIX_COLUMNS;
+
+    printf("\n%sExtension mix (%% of each root's files):%s\n", headerColor, resetColor);
+    for (int c = 0; c < columns; c++) {
+        char extDisplay[16];
+        snprintf(extDisplay, sizeof(extDisplay), "%s%.7s", strcmp(mix[c].ext, "no_ext") == 0 ? "" : ".",
+                 mix[c].ext);
+        printf("%8s", extDisplay);
+    }
+    printf("%8s   %s\n", "other", "Root");
+    printf("-------------------------------------------------------------------------------\n");
+    for (int i = 0; i < numRoots; i++) {
+        if (!scans[i])
+            continue;
+        long numFiles = dirstat_totals(scans[i])->numFiles;
+        long other = numFiles;
+        int extCount = 0;
+        DirstatExtCount *extCounts = dirstat_extensions(scans[i], DIRSTAT_SORT_DESCENDING, 0, &extCount);
+        for (int c = 0; c < columns; c++) {
+            long count = 0;
+            for (int e = 0; e < extCount; e++) {
+                if (strcmp(extCounts[e].ext, mix[c].ext) == 0) {
+                    count = extCounts[e].count;
+                    break;
+                }
+            }
+            other -= count;
+            printf("%8.1f", numFiles > 0 ? count * 100.0 / numFiles : 0.0);
+        }
+        printf("%8.1f   %s\n", numFiles > 0 ? other * 100.0 / numFiles : 0.0, roots[i]);
+        free(extCounts);
+    }
+    free(mix);
+}
 // ---------------------------------------------------------------------------
 // Print a horizontal percentage bar in the format:
 // [████████▒▒▒▒▒▒▒▒▒▒▒▒]  40.00%
@@ -323,6 +713,7 @@ void print_bar(double percentage, const char *color) {
     printf(" %6.2f%%", percentage);
 }
 
+
 // ---------------------------------------------------------------------------
 // Compute a gradient color (ANSI true-color code) for a given rank in the list.
 // The gradient spans from #35FE09 (highest) through #2C9918 to #2A5322 (lowest).
@@ -347,47 +738,208 @@ void get_gradient_color(int rank, int total, char *buffer, size_t buflen) {
     snprintf(buffer, buflen, "\033[38;2;%d;%d;%dm", r, g, b);
 }
 
+
 // ---------------------------------------------------------------------------
-// Main: compute and output overall project statistics with a gradient table.
-// Supports excluding files/folders with --exclude=pattern and various help options.
-// Also supports --toggle-ascii to use ASCII characters instead of Unicode blocks,
-// and --only-bar-color to disable text color for all output except the bars.
-// Also, if no directory is provided, uses the absolute current directory name.
+// Overall statistics and the extension table, for the table output format
 // ---------------------------------------------------------------------------
-#define MAX_EXCLUDES 100
+void print_statistics(const char *root, const DirstatProjectStats *projStats, const DirstatExtCount *extCounts,
+                      int extCount, double linesCi) {
+    // If --only-bar-color is specified, disable text color for headers
+    const char *headerColor = (useColor && !onlyBarColor) ? (ANSI_BOLD "\033[38;2;101;152;75m") : "";
+    const char *resetColor = useColor ? ANSI_RESET : "";
+    
+    // Print overall statistics
+    printf("\nProject Statistics for directory: %s\n", root);
+    printf("--------------------------------------------------------------\n");
+    printf("%sTotal number of folders:%s %ld\n", headerColor, resetColor, projStats->numDirs);
+    printf("%sTotal number of files  :%s %ld\n", headerColor, resetColor, projStats->numFiles);
+    double totalMB = projStats->stats.bytes / (1024.0 * 1024.0);
+    printf("%sTotal project size     :%s %.2f MB\n", headerColor, resetColor, totalMB);
+    if (binaryDetect) {
+        const DirstatFileStats *t = &projStats->stats;
+        printf("%sText files             :%s %lld (%.2f MB)\n", headerColor, resetColor,
+               projStats->numFiles - t->binaryFiles, (t->bytes - t->binaryBytes) / (1024.0 * 1024.0));
+        printf("%sBinary files           :%s %lld (%.2f MB, no lines counted)\n", headerColor, resetColor,
+               t->binaryFiles, t->binaryBytes / (1024.0 * 1024.0));
+    }
+    if (estimateMode) {
+        double ciPercent = projStats->stats.lines > 0 ? linesCi * 100.0 / (double) projStats->stats.lines : 0.0;
+        printf("%sTotal lines of code    :%s ~%lld (%s%.1f%%, 95%% CI)\n", headerColor, resetColor,
+               projStats->stats.lines, toggleAscii ? "+/-" : "±", ciPercent);
+    } else {
+        printf("%sTotal lines of code    :%s %lld\n", headerColor, resetColor, projStats->stats.lines);
+    }
+    if (classifyLines) {
+        const DirstatFileStats *t = &projStats->stats;
+        printf("%s  Code lines           :%s %lld\n", headerColor, resetColor, t->codeLines);
+        printf("%s  Comment lines        :%s %lld\n", headerColor, resetColor, t->commentLines);
+        printf("%s  Blank lines          :%s %lld\n", headerColor, resetColor, t->blankLines);
+        printf("%s  Unclassified lines   :%s %lld\n", headerColor, resetColor,
+               t->lines - t->codeLines - t->commentLines - t->blankLines);
+    }
+    printf("%sTotal characters       :%s %lld\n", headerColor, resetColor, projStats->stats.chars);
+    
+    // Print table header
+    if (classifyLines) {
+        printf("\n%-12s %8s %10s %12s %10s %10s %10s   %s\n", "Type", "Count", "Size", "Lines", "Code", "Comment",
+               "Blank", "Bar");
+        printf("--------------------------------------------------------------------------------"
+               "----------------------------------\n");
+    } else {
+        printf("\n%-12s %8s %10s %12s   %s\n", "Type", "Count", "Size", "Lines", "Bar");
+        printf("-------------------------------------------------------------------------------\n");
+    }
+    
+    // Print file type table rows
+    for (int i = 0; i < extCount; i++) {
+        double percentage = (projStats->numFiles > 0) ? ((extCounts[i].count * 100.0) / projStats->numFiles) : 0.0;
+        char gradColor[32] = "";
+        if (useColor)
+            get_gradient_color(i, extCount, gradColor, sizeof(gradColor));
+        char extDisplay[16];
+        if (strcmp(extCounts[i].ext, "no_ext") == 0)
+            snprintf(extDisplay, sizeof(extDisplay), "%s", extCounts[i].ext);
+        else
+            snprintf(extDisplay, sizeof(extDisplay), ".%s", extCounts[i].ext);
+        char sizeDisplay[16];
+        dirstat_format_size(extCounts[i].bytes, sizeDisplay, sizeof(sizeDisplay));
+        char linesDisplay[24];
+        snprintf(linesDisplay, sizeof(linesDisplay), "%s%lld", estimateMode ? "~" : "", extCounts[i].lines);
+        printf("%s%-12s%s %8ld %10s %12s ", headerColor, extDisplay, resetColor,
+               extCounts[i].count, sizeDisplay, linesDisplay);
+        if (classifyLines && extCounts[i].language)
+            printf("%10lld %10lld %10lld ", extCounts[i].codeLines, extCounts[i].commentLines,
+                   extCounts[i].blankLines);
+        else if (classifyLines)
+            printf("%10s %10s %10s ", "-", "-", "-");
+        printf("  ");
+        print_bar(percentage, gradColor);
+        if (estimateMode && extCounts[i].lines > 0)
+            printf(" %s%.1f%%", toggleAscii ? "+/-" : "±", extCounts[i].linesCi * 100.0 / (double) extCounts[i].lines);
+        printf("\n");
+    }
+}
 
 
-int main(int argc, char *argv[]) {
-    char *root = NULL;
-    char cwd[PATH_MAX];
-    const char *excludes[MAX_EXCLUDES];
-    int num_excludes = 0;
-    
-    // First pass: Check if there's a directory argument (not starting with '-')
-    int dir_arg_index = -1;
-    for (int i = 1; i < argc; i++) {
-        if (argv[i][0] != '-') {
-            dir_arg_index = i;
-            break;
-        }
+static int compare_ext_waste(const void *a, const void *b) {
+    const DirstatExtCount *ea = a, *eb = b;
+    if (ea->dupBytes != eb->dupBytes)
+        return ea->dupBytes < eb->dupBytes ? 1 : -1;
+    return strcmp(ea->ext, eb->ext);
+}
+
+// ---------------------------------------------------------------------------
+// --duplicates, table output: the bytes the copies waste per extension, then
+// the groups wasting the most. The first path of a group counts as the
+// original, the others as its copies.
+// ---------------------------------------------------------------------------
+void print_duplicates(const DirstatDupGroup *dups, int numDups, const DirstatExtCount *extCounts, int extCount,
+                      const char *headerColor, const char *resetColor) {
+    long copies = 0;
+    long long wasted = 0;
+    for (int i = 0; i < numDups; i++) {
+        copies += dups[i].count - 1;
+        wasted += dups[i].size * (dups[i].count - 1);
     }
+    char sizeDisplay[16], wastedDisplay[16];
+    dirstat_format_size(wasted, wastedDisplay, sizeof(wastedDisplay));
+    printf("\n%sDuplicate files:%s %ld cop%s in %d group%s, %s wasted\n", headerColor, resetColor, copies,
+           copies == 1 ? "y" : "ies", numDups, numDups == 1 ? "" : "s", wastedDisplay);
+    if (numDups == 0)
+        return;
 
-    // Set root directory
-    if (dir_arg_index != -1) {
-        root = strdup(argv[dir_arg_index]);
-    } else {
-        if (getcwd(cwd, sizeof(cwd)) != NULL) {
-            root = strdup(cwd);
-        } else {
-            perror("getcwd() error");
-            root = strdup(".");
+    DirstatExtCount *byWaste = malloc((size_t) extCount * sizeof(DirstatExtCount));
+    if (!byWaste) {
+        perror("malloc");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < extCount; i++) {
+        if (extCounts[i].dupFiles > 0)
+            byWaste[n++] = extCounts[i];
+    }
+    qsort(byWaste, (size_t) n, sizeof(DirstatExtCount), compare_ext_waste);
+    printf("%-12s %8s %10s\n", "Type", "Copies", "Wasted");
+    printf("-------------------------------\n");
+    for (int i = 0; i < n; i++) {
+        char extDisplay[16];
+        snprintf(extDisplay, sizeof(extDisplay), "%s%s", strcmp(byWaste[i].ext, "no_ext") == 0 ? "" : ".",
+                 byWaste[i].ext);
+        dirstat_format_size(byWaste[i].dupBytes, wastedDisplay, sizeof(wastedDisplay));
+        printf("%s%-12s%s %8ld %10s\n", headerColor, extDisplay, resetColor, byWaste[i].dupFiles, wastedDisplay);
+    }
+    free(byWaste);
+
+    printf("\n%sLargest duplicate groups:%s\n", headerColor, resetColor);
+    printf("%10s %8s %10s   %s\n", "Size", "Files", "Wasted", "Paths");
+    printf("-------------------------------------------------------------------------------\n");
+    for (int i = 0; i < numDups && i < DUP_GROUPS_SHOWN; i++) {
+        const DirstatDupGroup *g = &dups[i];
+        dirstat_format_size(g->size, sizeDisplay, sizeof(sizeDisplay));
+        dirstat_format_size(g->size * (g->count - 1), wastedDisplay, sizeof(wastedDisplay));
+        printf("%10s %8d %10s   %s\n", sizeDisplay, g->count, wastedDisplay, g->paths[0]);
+        for (int p = 1; p < g->count && p < DUP_PATHS_SHOWN; p++)
+            printf("%33s%s\n", "", g->paths[p]);
+        if (g->count > DUP_PATHS_SHOWN)
+            printf("%33s(%d more)\n", "", g->count - DUP_PATHS_SHOWN);
+    }
+    if (numDups > DUP_GROUPS_SHOWN)
+        printf("(%d more groups)\n", numDups - DUP_GROUPS_SHOWN);
+}
+
+// ---------------------------------------------------------------------------
+// --roots-from=FILE: append the directories listed in `path` (- for stdin),
+// one per line, to `roots`. Blank lines are skipped.
+// ---------------------------------------------------------------------------
+static void read_roots(const char *path, char ***roots, size_t *numRoots, size_t *capRoots) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    char *line = NULL;
+    size_t lineCap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &lineCap, f)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        *roots = grow_array(*roots, capRoots, *numRoots + 1, sizeof(char *));
+        if (!((*roots)[(*numRoots)++] = strdup(line))) {
+            perror("strdup");
+            exit(1);
         }
     }
+    free(line);
+    if (f != stdin)
+        fclose(f);
+}
 
-    // Process command-line arguments
+int main(int argc, char *argv[]) {
+    char **roots = NULL;
+    size_t numRoots = 0, capRoots = 0;
+    char cwd[PATH_MAX];
+    const char **excludes = NULL;
+    size_t num_excludes = 0, cap_excludes = 0;
+    double watchInterval = 0;   // Seconds between --watch updates, 0: no watching
+    int profileMode = 0;   // 1: --profile, 2: --profile=json
+    const char **binaryExts = NULL;
+    size_t numBinaryExts = 0, capBinaryExts = 0;
+    int jobsSet = 0;
+    DirstatOptions opts;
+    dirstat_options_init(&opts);
+
+    // Process command-line arguments; every argument not starting with '-'
+    // is a directory to scan.
     for (int i = 1; i < argc; i++) {
-        if (i == dir_arg_index) continue; // Skip the directory argument
-        if (argv[i][0] == '-') {
+        if (argv[i][0] != '-') {
+            roots = grow_array(roots, &capRoots, numRoots + 1, sizeof(char *));
+            if (!(roots[numRoots++] = strdup(argv[i]))) {
+                perror("strdup");
+                exit(1);
+            }
+        } else {
             // Check for help variants (case-insensitive)
             if (strcasecmp(argv[i], "-h") == 0 ||
                 strcasecmp(argv[i], "--h") == 0 ||
@@ -404,104 +956,274 @@ int main(int argc, char *argv[]) {
             else if (strcmp(argv[i], "--only-bar-color") == 0)
                 onlyBarColor = 1;
             else if (strncmp(argv[i], "--exclude=", 10) == 0) {
-                if (num_excludes < MAX_EXCLUDES)
-                    excludes[num_excludes++] = argv[i] + 10;
+                excludes = grow_array(excludes, &cap_excludes, num_excludes + 1, sizeof(const char *));
+                excludes[num_excludes++] = argv[i] + 10;
+            }
+            else if (strcmp(argv[i], "--gitignore") == 0)
+                opts.useGitignore = 1;
+            else if (strcmp(argv[i], "--git") == 0)
+                opts.gitMode = 1;
+            else if (strcmp(argv[i], "--watch") == 0)
+                watchInterval = WATCH_DEFAULT_INTERVAL;
+            else if (strncmp(argv[i], "--watch=", 8) == 0) {
+                watchInterval = parse_number_option("--watch=", argv[i] + 8, 0.001, 86400);
+            }
+            else if (strcmp(argv[i], "--follow-symlinks") == 0)
+                opts.followSymlinks = 1;
+            else if (strcmp(argv[i], "--no-follow-symlinks") == 0)
+                opts.followSymlinks = 0;
+            else if (strcmp(argv[i], "-x") == 0 || strcmp(argv[i], "--one-file-system") == 0)
+                opts.oneFileSystem = 1;
+            else if (strcmp(argv[i], "--count-hardlinks") == 0)
+                opts.dedupHardlinks = 0;
+            else if (strcmp(argv[i], "--dedup-hardlinks") == 0)
+                opts.dedupHardlinks = 1;
+            else if (strcmp(argv[i], "--estimate") == 0)
+                estimateMode = 1;
+            else if (strncmp(argv[i], "--estimate=", 11) == 0) {
+                estimateMode = 1;
+                opts.estimateRate = parse_number_option("--estimate=", argv[i] + 11, 0, 100) / 100.0;
+            }
+            else if (strncmp(argv[i], "--binary-ext=", 13) == 0) {
+                // Comma-separated; the tokens point into argv.
+                for (char *tok = strtok(argv[i] + 13, ","); tok; tok = strtok(NULL, ",")) {
+                    binaryExts = grow_array(binaryExts, &capBinaryExts, numBinaryExts + 1, sizeof(const char *));
+                    binaryExts[numBinaryExts++] = tok;
+                }
+            }
+            else if (strcmp(argv[i], "--no-binary-detect") == 0)
+                binaryDetect = 0;
+            else if (strcmp(argv[i], "--classify") == 0)
+                classifyLines = 1;
+            else if (strcmp(argv[i], "--duplicates") == 0)
+                findDuplicates = 1;
+            else if (strcmp(argv[i], "--cache") == 0)
+                opts.useCache = 1;
+            else if (strcmp(argv[i], "--no-cache") == 0)
+                opts.useCache = 0;
+            else if (strcmp(argv[i], "--rebuild-cache") == 0)
+                opts.useCache = opts.rebuildCache = 1;
+            else if (strncmp(argv[i], "--cache-file=", 13) == 0) {
+                opts.useCache = 1;
+                opts.cachePath = argv[i] + 13;
+            }
+            else if (strncmp(argv[i], "--roots-from=", 13) == 0) {
+                read_roots(argv[i] + 13, &roots, &numRoots, &capRoots);
+                batchMode = 1;
+            }
+            else if (strncmp(argv[i], "--io=", 5) == 0) {
+                if (strcmp(argv[i] + 5, "sync") == 0)
+                    opts.ioBackend = DIRSTAT_IO_SYNC;
+                else if (strcmp(argv[i] + 5, "mmap") == 0)
+                    opts.ioBackend = DIRSTAT_IO_MMAP;
+                else if (strcmp(argv[i] + 5, "uring") == 0)
+                    opts.ioBackend = DIRSTAT_IO_URING;
+                else {
+                    fprintf(stderr, "Unknown I/O backend '%s' (expected sync, mmap or uring)\n", argv[i] + 5);
+                    exit(1);
+                }
+            }
+            else if (strncmp(argv[i], "--format=", 9) == 0) {
+                if (strcmp(argv[i] + 9, "table") == 0)
+                    outputFormat = FORMAT_TABLE;
+                else if (strcmp(argv[i] + 9, "json") == 0)
+                    outputFormat = FORMAT_JSON;
+                else if (strcmp(argv[i] + 9, "ndjson") == 0)
+                    outputFormat = FORMAT_NDJSON;
+                else if (strcmp(argv[i] + 9, "csv") == 0)
+                    outputFormat = FORMAT_CSV;
+                else {
+                    fprintf(stderr, "Unknown output format '%s' (expected table, json, ndjson or csv)\n", argv[i] + 9);
+                    exit(1);
+                }
+            }
+            else if (strncmp(argv[i], "--top=", 6) == 0)
+                topDirs = parse_int_option("--top=", argv[i] + 6, 0, INT_MAX);
+            else if (strncmp(argv[i], "--depth=", 8) == 0)
+                treeDepth = parse_int_option("--depth=", argv[i] + 8, 0, INT_MAX);
+            else if (strncmp(argv[i], "--top-by=", 9) == 0) {
+                if (strcmp(argv[i] + 9, "bytes") == 0 || strcmp(argv[i] + 9, "size") == 0)
+                    treeKey = DIRSTAT_TREE_BY_BYTES;
+                else if (strcmp(argv[i] + 9, "lines") == 0)
+                    treeKey = DIRSTAT_TREE_BY_LINES;
+                else if (strcmp(argv[i] + 9, "files") == 0)
+                    treeKey = DIRSTAT_TREE_BY_FILES;
+                else {
+                    fprintf(stderr, "Unknown --top-by key '%s' (expected bytes, lines or files)\n", argv[i] + 9);
+                    exit(1);
+                }
+            }
+            else if (strcmp(argv[i], "--profile") == 0)
+                profileMode = 1;
+            else if (strcmp(argv[i], "--profile=json") == 0)
+                profileMode = 2;
+            else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+                jobsSet = 1;
+                opts.jobs = parse_int_option("--jobs=", argv[i] + 7, 0, INT_MAX);
+                if (opts.jobs == 0) {
+                    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    opts.jobs = (cpus > 0) ? (int) cpus : 1;
+                }
             }
             else if (strcmp(argv[i], "--sort-descending") == 0)
-                sortType = SORT_DESCENDING;
+                sortType = DIRSTAT_SORT_DESCENDING;
             else if (strcmp(argv[i], "--sort-ascending") == 0)
-                sortType = SORT_ASCENDING;
+                sortType = DIRSTAT_SORT_ASCENDING;
             else if (strcmp(argv[i], "--sort-alpha-asc") == 0)
-                sortType = SORT_ALPHA_ASC;
+                sortType = DIRSTAT_SORT_ALPHA_ASC;
             else if (strcmp(argv[i], "--sort-alpha-desc") == 0)
-                sortType = SORT_ALPHA_DESC;
+                sortType = DIRSTAT_SORT_ALPHA_DESC;
             else if (strcmp(argv[i], "--sort-num-asc") == 0)
-                sortType = SORT_NUM_ASC;
+                sortType = DIRSTAT_SORT_NUM_ASC;
             else if (strcmp(argv[i], "--sort-num-desc") == 0)
-                sortType = SORT_NUM_DESC;
+                sortType = DIRSTAT_SORT_NUM_DESC;
             else if (strcmp(argv[i], "--sort-natural-asc") == 0)
-                sortType = SORT_NATURAL_ASC;
+                sortType = DIRSTAT_SORT_NATURAL_ASC;
             else if (strcmp(argv[i], "--sort-natural-desc") == 0)
-                sortType = SORT_NATURAL_DESC;
+                sortType = DIRSTAT_SORT_NATURAL_DESC;
+            else if (strcmp(argv[i], "--sort-size-asc") == 0)
+                sortType = DIRSTAT_SORT_SIZE_ASC;
+            else if (strcmp(argv[i], "--sort-size-desc") == 0)
+                sortType = DIRSTAT_SORT_SIZE_DESC;
             else if (strcmp(argv[i], "--case-sensitive") == 0)
                 caseSensitive = 1;
         }
     }
     
-    ProjectStats projStats = {0, 0, {0, 0, 0}};
-    ExtCount *extCounts = NULL;
-    int extCount = 0, extCapacity = 0;
-    
-    // Process the directory
-    process_path(root, &projStats, &extCounts, &extCount, &extCapacity, excludes, num_excludes);
+    // No directory given: the current one
+    if (numRoots == 0 && !batchMode) {
+        roots = grow_array(roots, &capRoots, 1, sizeof(char *));
+        if (getcwd(cwd, sizeof(cwd)) != NULL) {
+            roots[numRoots++] = strdup(cwd);
+        } else {
+            perror("getcwd() error");
+            roots[numRoots++] = strdup(".");
+        }
+    }
+    if (numRoots > 1)
+        batchMode = 1;
+    if (outputFormat != FORMAT_TABLE) {
+        // The per-directory records already carry every directory's totals.
+        topDirs = 0;
+        treeDepth = -1;
+    }
+    if (batchMode) {
+        if (topDirs > 0 || treeDepth >= 0) {
+            fprintf(stderr, "--top and --depth cannot be combined with several roots\n");
+            exit(1);
+        }
+        // The roots share the walker threads, so use them all by default.
+        if (!jobsSet) {
+            long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            opts.jobs = (cpus > 0) ? (int) cpus : 1;
+        }
+    }
+    opts.excludes = excludes;
+    opts.numExcludes = (int) num_excludes;
+    opts.estimateMode = estimateMode;
+    opts.binaryDetect = binaryDetect;
+    opts.classify = classifyLines;
+    opts.duplicates = findDuplicates;
+    opts.binaryExts = binaryExts;
+    opts.numBinaryExts = (int) numBinaryExts;
+    opts.buildTree = topDirs > 0 || treeDepth >= 0;
+    opts.watch = watchInterval > 0;
+    opts.profile = profileMode != 0;
+    // Directory records are only written for the first scan's stream;
+    // --watch prints whole records only, several roots none.
+    DirstatHooks hooks = {NULL, NULL, NULL};
+    if (outputFormat != FORMAT_TABLE && !opts.watch && !batchMode)
+        hooks.directory = output_directory;
+
+    // The walk keeps a share of the fd limit of directory levels open (and
+    // reopens deeper ancestors as it needs them), --jobs walkers every
+    // directory with queued entries; allow as many as the hard limit permits.
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur < nofile.rlim_max) {
+        nofile.rlim_cur = nofile.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &nofile);
+    }
     
-    // Sort based on selected sort type
-    if (extCount > 0) {
-        switch (sortType) {
-            case SORT_DESCENDING:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_desc);
-                break;
-            case SORT_ASCENDING:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_num_asc);
-                break;
-            case SORT_ALPHA_ASC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_asc);
-                break;
-            case SORT_ALPHA_DESC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_natural_desc);
-                break;
-            case SORT_NUM_ASC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_num_asc);
-                break;
-            case SORT_NUM_DESC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_num_desc);
-                break;
-            case SORT_NATURAL_ASC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_natural_asc);
-                break;
-            case SORT_NATURAL_DESC:
-                qsort(extCounts, extCount, sizeof(ExtCount), compare_ext_natural_desc);
-                break;
-            // Note: SORT_SIZE_ASC and SORT_SIZE_DESC are defined but not implemented
-            // as we don't track size per extension yet
+    if (batchMode) {
+        Dirstat **scans = calloc(numRoots > 0 ? numRoots : 1, sizeof(Dirstat *));
+        if (!scans) {
+            perror("calloc");
+            exit(1);
         }
+        int failed = dirstat_scan_batch((const char **) roots, (int) numRoots, &opts, &hooks, scans);
+        if (failed < 0)
+            exit(1);
+        free(excludes);
+        free(binaryExts);
+        int dupFailed = 0;
+        if (outputFormat == FORMAT_TABLE)
+            print_comparison((const char **) roots, scans, (int) numRoots);
+        else
+            dupFailed = output_batch((const char **) roots, scans, (int) numRoots);
+        for (size_t i = 0; i < numRoots; i++) {
+            dirstat_free(scans[i]);
+            free(roots[i]);
+        }
+        free(scans);
+        free(roots);
+        return failed > 0 || dupFailed > 0;
+    }
+
+    // Process the directory
+    char *root = roots[0];
+    if (hooks.directory)
+        output_begin(root);
+    Dirstat *ds = dirstat_scan(root, &opts, &hooks);
+    if (!ds)
+        exit(1);
+    free(excludes);
+    free(binaryExts);
+    if (opts.watch) {
+        watch_render(ds, root);
+        dirstat_watch(ds, watchInterval, watch_render, root);
+    }
+    const DirstatProjectStats *projStats = dirstat_totals(ds);
+    double linesCi = dirstat_lines_ci(ds);
+    int extCount = 0;
+    DirstatExtCount *extCounts = dirstat_extensions(ds, sortType, caseSensitive, &extCount);
+    int numDups = 0;
+    const DirstatDupGroup *dups = dirstat_duplicates(ds, &numDups);
+    int dupFailed = numDups < 0;
+    if (dupFailed) {
+        fprintf(stderr, "--duplicates: out of memory, no duplicates reported\n");
+        numDups = 0;
     }
     
+    if (outputFormat != FORMAT_TABLE) {
+        output_end(root, projStats, extCounts, extCount, linesCi, dups, numDups);
+        // On stderr, so the machine-readable output stays clean
+        dirstat_print_profile(ds, stderr, profileMode == 2, toggleAscii);
+        free(extCounts);
+        dirstat_free(ds);
+        free(root);
+        free(roots);
+        return dupFailed;
+    }
+
     // If --only-bar-color is specified, disable text color for headers
     const char *headerColor = (useColor && !onlyBarColor) ? (ANSI_BOLD "\033[38;2;101;152;75m") : "";
     const char *resetColor = useColor ? ANSI_RESET : "";
     
-    // Print overall statistics
-    printf("\nProject Statistics for directory: %s\n", root);
-    printf("--------------------------------------------------------------\n");
-    printf("%sTotal number of folders:%s %ld\n", headerColor, resetColor, projStats.numDirs);
-    printf("%sTotal number of files  :%s %ld\n", headerColor, resetColor, projStats.numFiles);
-    double totalMB = projStats.stats.bytes / (1024.0 * 1024.0);
-    printf("%sTotal project size     :%s %.2f MB\n", headerColor, resetColor, totalMB);
-    printf("%sTotal lines of code    :%s %lld\n", headerColor, resetColor, projStats.stats.lines);
-    printf("%sTotal characters       :%s %lld\n", headerColor, resetColor, projStats.stats.chars);
-    
-    // Print table header
-    printf("\n%-12s %8s   %s\n", "Type", "Count", "Bar");
-    printf("--------------------------------------------------------------\n");
-    
-    // Print file type table rows
-    for (int i = 0; i < extCount; i++) {
-        double percentage = (projStats.numFiles > 0) ? ((extCounts[i].count * 100.0) / projStats.numFiles) : 0.0;
-        char gradColor[32] = "";
-        if (useColor)
-            get_gradient_color(i, extCount, gradColor, sizeof(gradColor));
-        char extDisplay[16];
-        if (strcmp(extCounts[i].ext, "no_ext") == 0)
-            snprintf(extDisplay, sizeof(extDisplay), "%s", extCounts[i].ext);
-        else
-            snprintf(extDisplay, sizeof(extDisplay), ".%s", extCounts[i].ext);
-        printf("%s%-12s%s %8ld   ", headerColor, extDisplay, resetColor, extCounts[i].count);
-        print_bar(percentage, gradColor);
-        printf("\n");
-    }
+    print_statistics(root, projStats, extCounts, extCount, linesCi);
+    if (findDuplicates && !dupFailed)
+        print_duplicates(dups, numDups, extCounts, extCount, headerColor, resetColor);
+
+    const DirstatTreeDir *treeRoot = dirstat_tree(ds);
+    if (topDirs > 0 && treeRoot)
+        print_top_dirs(ds, topDirs, headerColor, resetColor);
+    if (treeDepth >= 0 && treeRoot)
+        print_dir_tree(treeRoot, treeDepth, headerColor, resetColor);
+
+    dirstat_print_profile(ds, profileMode == 2 ? stderr : stdout, profileMode == 2, toggleAscii);
     
     free(extCounts);
+    dirstat_free(ds);
     free(root);
-    return 0;
+    free(roots);
+    return dupFailed;
 }
@@ -0,0 +1,5699 @@
+#define _GNU_SOURCE   // for statx, O_DIRECTORY and friends
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <strings.h>  // for strcasecmp
+#include <limits.h>   // for PATH_MAX
+#include <ctype.h>    // for isdigit() and tolower()
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>     // for nanosleep
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/resource.h>  // for getrusage
+#include <sys/sysmacros.h> // for makedev
+#include <sys/inotify.h>   // for --watch
+#include <poll.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#include "libdirstat.h"
+
+// Size of the blocks dirstat_file_stats reads at a time
+#define READ_BLOCK_SIZE (128 * 1024)
+
+// --io=mmap maps files at least this large; smaller ones are read()
+#define MMAP_MIN_SIZE (1024 * 1024)
+
+// Scan cache file format
+#define CACHE_MAGIC "DSTCACHE"
+#define CACHE_VERSION 6
+// Directory under $XDG_CACHE_HOME that holds the caches of all roots
+#define CACHE_DIR_NAME "dirstat"
+
+// Buffer size for one getdents64 call
+#define DIRENT_BUF_SIZE (64 * 1024)
+
+// Share of the open file limit (1/N) a walker may fill with the directories
+// down one path; the fds of ancestors further up are closed while their
+// subtrees are walked and reopened afterwards
+#define DIR_OPEN_FRAMES_SHARE 4
+#define DIR_OPEN_FRAMES_MIN 16
+
+// --estimate: bytes read from each sampled file (in ESTIMATE_CHUNKS pieces),
+// the smallest sample of every extension, and the default share of the
+// files sampled (percent)
+#define ESTIMATE_SAMPLE_SIZE (64 * 1024)
+#define ESTIMATE_CHUNKS 8
+#define ESTIMATE_MIN_SAMPLES 32
+#define ESTIMATE_DEFAULT_RATE 2.0
+
+// A file is binary if its first block starts with a known magic number or
+// has a NUL byte in its first BINARY_PROBE_SIZE bytes (the same rule as git)
+#define BINARY_PROBE_SIZE 8000
+
+// --duplicates: bytes at the start of a file hashed while it is read anyway;
+// only files whose heads match are hashed in full
+#define DUP_HEAD_SIZE 4096
+
+// --top / --depth: directory tree nodes allocated per arena chunk
+#define TREE_CHUNK_NODES 4096
+
+// Shards of the (dev, ino) set that dedups directories and hardlinks
+#define INODE_SET_SHARDS 64
+
+// --io=uring: files kept in flight per ring, and the read size per file
+#define URING_DEPTH 32
+#define URING_BLOCK_SIZE (64 * 1024)
+
+// --profile: slowest files/directories kept, and log2 histogram buckets
+#define PROFILE_TOP 10
+#define PROFILE_HIST_BUCKETS 64
+
+
+// ---------------------------------------------------------------------------
+// Structures
+// ---------------------------------------------------------------------------
+// Interned extension strings live in chunks that never move, so DirstatExtCount.ext
+// stays valid while the table grows.
+typedef struct StrChunk {
+    struct StrChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} StrChunk;
+
+// --estimate: the ESTIMATE_MIN_SAMPLES small files of one extension with the
+// lowest sampling hash among those above the rate, as a max-heap on the hash
+typedef struct {
+    int n;
+    struct {
+        unsigned long long hash;
+        long long bytes, lines;
+    } items[ESTIMATE_MIN_SAMPLES];
+} EstimateReserve;
+
+typedef struct {
+    unsigned long long hash;   // 0 marks an empty slot
+    DirstatExtCount entry;
+    EstimateReserve *reserve;  // --estimate only, until estimate_settle()
+} ExtSlot;
+
+// Open-addressing (linear probing) hash table of extensions.
+typedef struct {
+    ExtSlot *slots;
+    size_t capacity;   // power of two, 0 until the first insert
+    size_t used;
+    StrChunk *strings;
+} ExtTable;
+
+// ---------------------------------------------------------------------------
+// On-disk scan cache ($XDG_CACHE_HOME/dirstat/<root hash> or --cache-file).
+// All integers are native-endian; the cache is local to the machine that
+// wrote it.
+//
+//   CacheHeader
+//   CacheFileEntry[numFiles]   sorted by (dev, ino)
+//   CacheDirEntry[numDirs]     sorted by (dev, ino)
+//   strings[stringsSize]       NUL-terminated extensions
+//   names[namesSize]           per directory: numNames entries, each a d_type
+//                              byte followed by the NUL-terminated name
+// ---------------------------------------------------------------------------
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    int64_t scanStartSec;   // entries modified at or after this are not trusted
+    uint64_t numFiles;
+    uint64_t numDirs;
+    uint64_t stringsSize;
+    uint64_t namesSize;
+    uint32_t binaryDetect;  // written with binary detection on
+    uint32_t classify;      // written with line classification on
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtimeSec;
+    uint32_t mtimeNsec;
+    uint32_t extOffset;     // into strings
+    int64_t ctimeSec;       // a file rewritten with its old mtime still gets a new ctime
+    uint32_t ctimeNsec;
+    uint32_t flags;         // CACHE_FILE_*
+    int64_t bytes;          // the file's DirstatFileStats; its chars are its bytes unless binary
+    int64_t lines;
+    int64_t codeLines;      // with classify; the rest of the lines are blank
+    int64_t commentLines;
+    uint32_t headHash;      // with CACHE_FILE_HEAD_HASH: the hash of the first DUP_HEAD_SIZE bytes
+} CacheFileEntry;
+
+#define CACHE_FILE_BINARY 1u      // counted as a binary file
+#define CACHE_FILE_HEAD_HASH 2u   // headHash is set (the file was read with --duplicates)
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtimeSec;
+    uint32_t mtimeNsec;
+    uint32_t numNames;
+    uint64_t namesOffset;   // into names
+} CacheDirEntry;
+
+// A loaded (mmap'ed) cache. Read-only and shared by all walkers.
+typedef struct {
+    void *map;
+    size_t mapSize;
+    const CacheHeader *header;
+    const CacheFileEntry *files;
+    const CacheDirEntry *dirs;
+    const char *strings;
+    const char *names;
+} ScanCache;
+
+// A file seen during this scan, to be written to the next cache.
+typedef struct {
+    CacheFileEntry entry;
+    const char *ext;        // interned in the walker's ExtTable
+} CacheRecord;
+
+// --duplicates: the hash of a file's first DUP_HEAD_SIZE bytes, taken while
+// it is read for its lines
+typedef struct {
+    uint32_t hash;
+    int done;
+} HeadHash;
+
+// --duplicates: a non-empty regular file seen by one walker. Files whose head
+// was not hashed during the walk (binary extensions, files --estimate did
+// not sample) are only read for it afterwards, and only if another file has
+// the same size.
+typedef struct {
+    uint64_t dev, ino;
+    long long size;
+    const char *path;       // interned in the walker's dupPaths
+    const char *ext;        // interned in the walker's ExtTable
+    uint64_t fullHash;      // of the whole file, once heads collide
+    HeadHash head;
+} DupFile;
+
+typedef struct WorkQueue WorkQueue;
+typedef struct IoRing IoRing;
+typedef struct ExcludeMatcher ExcludeMatcher;
+typedef struct IgnoreList IgnoreList;
+typedef struct InodeSet InodeSet;
+typedef struct Watcher Watcher;
+typedef struct Language Language;
+
+// State a directory passes down to its entries while walking
+typedef struct {
+    int excludeState;      // Aho-Corasick state after this directory's path
+    IgnoreList *ignore;    // .gitignore rules in effect (--gitignore), referenced
+} WalkContext;
+
+// TreeDirs of the directory tree (buildTree) come from the walker's arena
+// chunks and are never freed one by one. Children are linked after the scan.
+typedef struct TreeChunk {
+    struct TreeChunk *next;
+    size_t used;
+    DirstatTreeDir nodes[TREE_CHUNK_NODES];
+} TreeChunk;
+
+// Interned strings: open addressing over pointers into StrChunks
+typedef struct {
+    const char **slots;   // NULL: empty
+    size_t capacity;      // power of two, 0 until the first insert
+    size_t used;
+    StrChunk *strings;
+} NameTable;
+
+// Running totals of one directory's subtree for the directory hook and the
+// directory tree. Referenced by the directory's handle, by io_uring reads of
+// its files still in flight and by its subdirectories until they finish;
+// when the last reference goes, the hook is called, its totals are stored in
+// its DirstatTreeDir and added to the parent. Only directories still being walked
+// are in memory.
+typedef struct DirNode {
+    struct DirNode *parent;
+    char *path;           // only with a directory hook
+    const DirstatHooks *hooks;
+    DirstatTreeDir *tree; // buildTree only
+    atomic_int refs;
+    atomic_long files, dirs;
+    atomic_llong bytes, lines, chars;
+} DirNode;
+
+// An open directory. Entries are opened relative to it with openat/statx, so
+// the kernel never re-resolves a full path and path length is unlimited. The
+// fd is closed once nothing refers to it any more: the walker listing it,
+// queued children (--jobs) and in-flight io_uring opens each hold a reference.
+typedef struct {
+    int fd;
+    atomic_int refs;
+    atomic_long *queued;   // --jobs: the queue's count of directories kept open
+                           // for their queued entries, if this is one, or NULL
+    DirNode *node;     // subtree totals (directory hook, buildTree), or NULL
+    int wd;            // --watch: its inotify watch descriptor, below -1 if it
+                       // could not be watched, or -1
+    dev_t dev;         // identify the directory if fd has to be reopened;
+    ino_t ino;         // ino is 0 if unknown
+} DirHandle;
+
+// --profile: phases of a scan that are timed separately
+typedef enum {
+    PHASE_OPENDIR,    // openat of directories
+    PHASE_READDIR,    // getdents64
+    PHASE_STAT,       // statx / fstat
+    PHASE_OPEN,       // openat of files
+    PHASE_READ,       // read, or mmap/madvise/munmap/fadvise with --io=mmap
+    PHASE_COUNT,      // newline counting (CPU only)
+    PHASE_CLOSE,      // close of files
+    PHASE_URING,      // io_uring_enter: submitting and waiting with --io=uring
+    NUM_PHASES
+} ProfilePhase;
+
+typedef struct {
+    unsigned long long ns;
+    unsigned long long calls;   // system calls (blocks counted for PHASE_COUNT)
+} PhaseTimer;
+
+typedef struct {
+    unsigned long long ns;
+    char *path;
+} SlowEntry;
+
+// Counters of one walker for --profile; merged into the main one at the end.
+typedef struct {
+    PhaseTimer phases[NUM_PHASES];
+    unsigned long long bytesRead;
+    unsigned long long ringRequests;   // openat/read/close run through io_uring
+    unsigned long long sizeHist[PROFILE_HIST_BUCKETS];      // file sizes in bytes
+    unsigned long long latencyHist[PROFILE_HIST_BUCKETS];   // open to close, in ns
+    SlowEntry slowFiles[PROFILE_TOP];     // slowest first
+    SlowEntry slowDirs[PROFILE_TOP];
+    int numSlowFiles, numSlowDirs;
+} ScanProfile;
+
+// Everything one walker needs while scanning. The serial walk uses a single
+// ScanState; --jobs=N gives every worker thread its own and merges them at the end.
+typedef struct {
+    Dirstat *ds;       // the scan's options and hooks
+    DirstatProjectStats projStats;
+    ExtTable exts;
+    const ExcludeMatcher *excludes;   // compiled --exclude patterns, or NULL
+    int useGitignore;                 // honor .gitignore files (--gitignore)
+    size_t rootLen;                   // length of the root path within `path`
+    WorkQueue *queue;  // NULL for the recursive serial walk
+    int workerId;
+    IoRing *ring;      // --io=uring only; file reads are queued here
+    const ScanCache *cache;       // previous results, or NULL
+    int recordCache;              // collect records for the next cache
+    dev_t skipDev;                // the cache file itself is never counted
+    ino_t skipIno;
+    InodeSet *seen;               // directories and hardlinked files already counted
+    dev_t rootDev;                // for --one-file-system
+    const char *skipName;         // basename of the cache file
+    char *path;                   // full path of the entry being visited
+    size_t pathLen, pathCap;
+    char *entries;                // stack of listed directory entries: d_type byte, name, NUL
+    size_t entriesLen, entriesCap;
+    char *direntBuf;              // getdents64 buffer
+    CacheRecord *cacheFiles;
+    size_t numCacheFiles, capCacheFiles;
+    CacheDirEntry *cacheDirs;
+    size_t numCacheDirs, capCacheDirs;
+    char *cacheNames;             // names blob for cacheDirs
+    size_t cacheNamesLen, cacheNamesCap;
+    ScanProfile *profile;         // --profile counters, or NULL
+    TreeChunk *treeChunks;        // --top/--depth: this walker's tree nodes
+    NameTable treeNames;
+    Watcher *watch;               // --watch: per-file records and inotify watches, or NULL
+    DupFile *dupFiles;            // --duplicates: every file counted
+    size_t numDupFiles, capDupFiles;
+    StrChunk *dupPaths;
+    int dupFailed;                // --duplicates ran out of memory and gave up
+} ScanState;
+
+// One scan: its options, the merged results and everything needed to keep
+// them current with dirstat_watch.
+struct Dirstat {
+    DirstatOptions opts;          // the strings are not kept
+    DirstatHooks hooks;
+    char *root;
+    char **binaryExts;            // defaults and opts.binaryExts, lowercase and sorted
+    size_t numBinaryExts;
+    ExcludeMatcher *excludes;
+    char *cachePath;
+    ScanCache *cache;
+    ScanState scan;               // the merged results
+    double linesCi;
+    DirstatTreeDir *tree;
+    time_t scanStart;             // for the cache: files changed since are not trusted
+    unsigned long long scanStartNs;
+    double wallSec;               // --profile
+    struct rusage usage;
+    int updating;                 // dirstat_watch is applying changes
+    atomic_int outOfFds;          // an entry could not be opened for lack of fds
+    DirstatDupGroup *dupGroups;   // --duplicates, most wasted bytes first
+    int numDupGroups;             // -1: --duplicates ran out of memory
+    const char **dupGroupPaths;   // the groups' paths, pointing into scan.dupPaths
+};
+
+
+
+// ---------------------------------------------------------------------------
+// Function Declarations
+// ---------------------------------------------------------------------------
+// Everything but the libdirstat.h API is internal to the library.
+static DirstatFileStats get_file_stats_at(int dirfd, const char *name, int detectBinary, const Language *lang,
+                                          HeadHash *head);
+static DirstatFileStats get_file_sample_stats(int dirfd, const char *name, long long limit, int chunks,
+                                              int detectBinary, const Language *lang, HeadHash *head);
+static DirstatFileStats get_file_stats_mmap(int dirfd, const char *name, off_t sizeHint, int detectBinary,
+                                            const Language *lang, HeadHash *head);
+static const Language *extension_language(const char *ext);
+static void binary_exts_init(Dirstat *ds, const char **exts, int numExts);
+static int binary_extension(const Dirstat *ds, const char *ext);
+static int binary_block(const unsigned char *buf, size_t len);
+static ExtSlot *ext_table_slot(ExtTable *table, const char *ext);
+static DirstatExtCount *ext_table_get(ExtTable *table, const char *ext);
+static void update_extension_counts(ExtTable *table, const char *ext, DirstatFileStats fstats);
+static void merge_extension_counts(ExtTable *dst, const ExtTable *src);
+static DirstatExtCount *ext_table_entries(const ExtTable *table, int *count);
+static void ext_table_free(ExtTable *table);
+static ScanCache *cache_open(const char *cachePath, int binaryDetect, int classify);
+static void cache_close(ScanCache *cache);
+static const CacheFileEntry *cache_lookup_file(const ScanCache *cache, const struct stat *st, const char *ext);
+static const CacheDirEntry *cache_lookup_dir(const ScanCache *cache, const struct stat *st);
+static void cache_record_file(ScanState *scan, const struct stat *st, const char *ext, DirstatFileStats fstats,
+                              const HeadHash *head);
+static void cache_merge_records(ScanState *dst, ScanState *src);
+static int cache_write(const char *cachePath, ScanState *scan, time_t scanStart);
+static void dup_record_file(ScanState *scan, const struct stat *st, const char *path, const char *ext,
+                            const HeadHash *head);
+static void dup_merge(ScanState *dst, ScanState *src);
+static void dup_find(Dirstat *ds);
+static void dup_free(Dirstat *ds);
+static void dir_handle_release(DirHandle *dir);
+static InodeSet *inode_set_new(void);
+static void inode_set_free(InodeSet *set);
+static int inode_set_insert(InodeSet *set, dev_t dev, ino_t ino);
+static void inode_set_remove(InodeSet *set, dev_t dev, ino_t ino);
+static void dir_node_release(DirNode *node);
+static DirstatTreeDir *tree_dir_new(ScanState *scan, DirstatTreeDir *parent, const char *name);
+static void tree_merge(ScanState *dst, ScanState *src);
+static void tree_free(ScanState *scan);
+static DirstatTreeDir *tree_link(ScanState *scan);
+static unsigned long long estimate_hash(const char *relPath);
+static int estimate_sampled(double rate, unsigned long long hash);
+static int estimate_reserve_wants(const EstimateReserve *r, unsigned long long hash);
+static void estimate_reserve_add(EstimateReserve **r, unsigned long long hash, long long bytes, long long lines);
+static void estimate_add_sample(DirstatEstimateSample *s, DirstatFileStats sample);
+static void estimate_merge(DirstatEstimateSample *dst, const DirstatEstimateSample *src);
+static void estimate_settle(ExtTable *table);
+static double estimate_finish(DirstatExtCount *entries, int count, DirstatProjectStats *projStats);
+static void scan_check_fds(ScanState *scan, const char *path, int err);
+static void process_path(const char *path, ScanState *scan);
+static int git_scan(const char *root, ScanState *scan);
+static Watcher *watcher_new(void);
+static void watcher_free(Watcher *w);
+static void watch_add_dir(ScanState *scan, DirHandle *dir, const DirHandle *parent, const WalkContext *ctx);
+static void watch_record_file(ScanState *scan, const DirHandle *dir, const char *name, const char *ext,
+                              DirstatFileStats fstats, const struct stat *st);
+static void scan_parallel(Dirstat **scans, int numScans, int jobs);
+static int compare_ext_desc(const void *a, const void *b, void *caseSensitive);
+static ExcludeMatcher *exclude_compile(const char **patterns, int numPatterns);
+static void exclude_free(ExcludeMatcher *m);
+static int exclude_advance(const ExcludeMatcher *m, int state, const char *s);
+static int exclude_glob_match(const ExcludeMatcher *m, const char *relPath, const char *name, int isDir);
+static int glob_match(const char *pattern, const char *str);
+static IgnoreList *ignore_list_load(int dirfd, IgnoreList *parent, size_t baseLen);
+static int ignore_list_match(const IgnoreList *list, const char *path, const char *name, int isDir);
+static void ignore_list_release(IgnoreList *list);
+static void profile_merge(ScanProfile *dst, ScanProfile *src);
+static void profile_print(FILE *out, const ScanProfile *p, double wallSec, const struct rusage *usage, int jobs, int ascii);
+static void profile_print_json(FILE *out, const ScanProfile *p, double wallSec, const struct rusage *usage, int jobs);
+static void profile_free(ScanProfile *p);
+
+// Extension comparisons for dirstat_extensions; `arg` points to the
+// caseSensitive flag.
+static int compare_ext_name(const DirstatExtCount *ea, const DirstatExtCount *eb, int caseSensitive) {
+    return caseSensitive ? strcmp(ea->ext, eb->ext) : strcasecmp(ea->ext, eb->ext);
+}
+
+static int compare_ext_asc(const void *a, const void *b, void *arg) {
+    return compare_ext_name(a, b, *(const int *) arg);
+}
+
+static int compare_ext_num_asc(const void *a, const void *b, void *arg) {
+    const DirstatExtCount *ea = (const DirstatExtCount*) a;
+    const DirstatExtCount *eb = (const DirstatExtCount*) b;
+    if (ea->count == eb->count)
+        return compare_ext_name(ea, eb, *(const int *) arg);
+    return (ea->count > eb->count) ? 1 : -1;
+}
+
+static int compare_ext_num_desc(const void *a, const void *b, void *arg) {
+    return compare_ext_num_asc(b, a, arg);
+}
+
+// Simple natural sort comparison (basic implementation)
+static int strnatcmp(const char *a, const char *b, int caseSensitive) {
+    while (*a && *b) {
+        if (isdigit(*a) && isdigit(*b)) {
+            long na = 0, nb = 0;
+            while (isdigit(*a)) na = na * 10 + (*a++ - '0');
+            while (isdigit(*b)) nb = nb * 10 + (*b++ - '0');
+            if (na != nb) return (na > nb) ? 1 : -1;
+        } else {
+            if (tolower(*a) != tolower(*b))
+                return caseSensitive ? (*a - *b) : (tolower(*a) - tolower(*b));
+            a++; b++;
+        }
+    }
+    return caseSensitive ? (*a - *b) : (tolower(*a) - tolower(*b));
+}
+
+static int compare_ext_natural_asc(const void *a, const void *b, void *arg) {
+    const DirstatExtCount *ea = (const DirstatExtCount*) a;
+    const DirstatExtCount *eb = (const DirstatExtCount*) b;
+    return strnatcmp(ea->ext, eb->ext, *(const int *) arg);
+}
+
+static int compare_ext_natural_desc(const void *a, const void *b, void *arg) {
+    return compare_ext_natural_asc(b, a, arg);
+}
+
+static int compare_ext_size_asc(const void *a, const void *b, void *arg) {
+    const DirstatExtCount *ea = (const DirstatExtCount*) a;
+    const DirstatExtCount *eb = (const DirstatExtCount*) b;
+    if (ea->bytes == eb->bytes)
+        return compare_ext_name(ea, eb, *(const int *) arg);
+    return (ea->bytes > eb->bytes) ? 1 : -1;
+}
+
+static int compare_ext_size_desc(const void *a, const void *b, void *arg) {
+    return compare_ext_size_asc(b, a, arg);
+}
+
+// ---------------------------------------------------------------------------
+// Make room for at least `needed` elements in a realloc'ed array
+// ---------------------------------------------------------------------------
+static void *grow_array(void *array, size_t *capacity, size_t needed, size_t elemSize) {
+    if (needed <= *capacity)
+        return array;
+    size_t newCapacity = (*capacity == 0) ? 256 : *capacity;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    array = realloc(array, newCapacity * elemSize);
+    if (!array) {
+        perror("realloc");
+        exit(1);
+    }
+    *capacity = newCapacity;
+    return array;
+}
+
+// ---------------------------------------------------------------------------
+// Glob matching with .gitignore semantics: '*' and '?' never match '/',
+// "**/" matches zero or more leading directories, a trailing "/**" (or any
+// other "**") matches everything, "[a-z]" / "[!a-z]" are character classes
+// and '\' escapes the next character.
+// ---------------------------------------------------------------------------
+static int glob_match_class(const char **pattern, char c) {
+    const char *p = *pattern + 1;
+    int negate = (*p == '!' || *p == '^');
+    if (negate)
+        p++;
+    int matched = 0;
+    const char *start = p;
+    while (*p && (*p != ']' || p == start)) {
+        char lo = *p++;
+        if (lo == '\\' && *p)
+            lo = *p++;
+        char hi = lo;
+        if (*p == '-' && p[1] && p[1] != ']') {
+            p++;
+            hi = *p++;
+            if (hi == '\\' && *p)
+                hi = *p++;
+        }
+        if ((unsigned char) c >= (unsigned char) lo && (unsigned char) c <= (unsigned char) hi)
+            matched = 1;
+    }
+    if (*p != ']')
+        return -1;  // unterminated: '[' is a literal
+    *pattern = p + 1;
+    return matched != negate;
+}
+
+int glob_match(const char *p, const char *s) {
+    for (;;) {
+        char c = *p;
+        if (c == '\0')
+            return *s == '\0';
+        if (c == '*') {
+            if (p[1] == '*') {
+                const char *rest = p + 2;
+                if (*rest == '/') {
+                    rest++;
+                    for (const char *t = s;;) {
+                        if (glob_match(rest, t))
+                            return 1;
+                        t = strchr(t, '/');
+                        if (!t)
+                            return 0;
+                        t++;
+                    }
+                }
+                for (const char *t = s;; t++) {
+                    if (glob_match(rest, t))
+                        return 1;
+                    if (*t == '\0')
+                        return 0;
+                }
+            }
+            p++;
+            for (const char *t = s;; t++) {
+                if (glob_match(p, t))
+                    return 1;
+                if (*t == '\0' || *t == '/')
+                    return 0;
+            }
+        }
+        if (*s == '\0')
+            return 0;
+        if (c == '?') {
+            if (*s == '/')
+                return 0;
+            p++;
+            s++;
+            continue;
+        }
+        if (c == '[') {
+            const char *q = p;
+            int m = glob_match_class(&q, *s);
+            if (m >= 0) {
+                if (!m || *s == '/')
+                    return 0;
+                p = q;
+                s++;
+                continue;
+            }
+        }
+        if (c == '\\' && p[1])
+            c = *++p;
+        if (c != *s)
+            return 0;
+        p++;
+        s++;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Compiled --exclude patterns.
+// Plain patterns keep their original meaning (exclude any path containing
+// the pattern) and are compiled into one Aho-Corasick automaton with full
+// DFA transitions. Walkers carry the automaton state of each directory's
+// path, so checking an entry only feeds "/name" through it instead of
+// re-scanning the full path against every pattern.
+// Patterns containing *, ? or [ are globs with .gitignore rules: without a
+// '/' they match the entry name at any depth, otherwise the path relative to
+// the root; a trailing '/' restricts them to directories.
+// ---------------------------------------------------------------------------
+typedef struct {
+    char *pattern;
+    int negate;      // "!pattern" in a .gitignore
+    int dirOnly;     // trailing '/'
+    int anchored;    // contains '/': matched against the relative path
+} IgnoreRule;
+
+struct ExcludeMatcher {
+    int32_t *delta;           // numStates x 256 transitions
+    unsigned char *accept;    // state completes some pattern
+    int numStates;
+    IgnoreRule *globs;
+    int numGlobs;
+};
+
+struct IgnoreList {
+    IgnoreList *parent;
+    size_t baseLen;           // path length of the directory holding the .gitignore
+    IgnoreRule *rules;
+    int numRules;
+    atomic_int refs;
+};
+
+// Parse one pattern line (.gitignore syntax) into `rule`. Returns 0 for
+// blank lines and comments.
+static int parse_ignore_rule(char *line, IgnoreRule *rule) {
+    size_t len = strlen(line);
+    if (len > 0 && line[len - 1] == '\r')
+        line[--len] = '\0';
+    // Trailing spaces are ignored unless escaped.
+    while (len > 0 && line[len - 1] == ' ' && (len < 2 || line[len - 2] != '\\'))
+        line[--len] = '\0';
+    if (len == 0 || line[0] == '#')
+        return 0;
+    memset(rule, 0, sizeof(*rule));
+    if (line[0] == '!') {
+        rule->negate = 1;
+        line++;
+        len--;
+    } else if (line[0] == '\\' && (line[1] == '!' || line[1] == '#')) {
+        line++;
+        len--;
+    }
+    if (len > 0 && line[len - 1] == '/') {
+        rule->dirOnly = 1;
+        line[--len] = '\0';
+    }
+    if (len == 0)
+        return 0;
+    rule->anchored = strchr(line, '/') != NULL;
+    if (line[0] == '/')
+        line++;
+    rule->pattern = strdup(line);
+    if (!rule->pattern) {
+        perror("strdup");
+        exit(1);
+    }
+    return 1;
+}
+
+static int rule_matches(const IgnoreRule *rule, const char *relPath, const char *name, int isDir) {
+    if (rule->dirOnly && !isDir)
+        return 0;
+    return glob_match(rule->pattern, rule->anchored ? relPath : name);
+}
+
+ExcludeMatcher *exclude_compile(const char **patterns, int numPatterns) {
+    if (numPatterns == 0)
+        return NULL;
+    ExcludeMatcher *m = calloc(1, sizeof(ExcludeMatcher));
+    if (!m) {
+        perror("calloc");
+        exit(1);
+    }
+    size_t maxStates = 1;
+    for (int i = 0; i < numPatterns; i++)
+        maxStates += strlen(patterns[i]);
+    m->delta = malloc(maxStates * 256 * sizeof(int32_t));
+    m->accept = calloc(maxStates, 1);
+    m->globs = calloc((size_t) numPatterns, sizeof(IgnoreRule));
+    int32_t *fail = calloc(maxStates, sizeof(int32_t));
+    int32_t *order = malloc(maxStates * sizeof(int32_t));
+    if (!m->delta || !m->accept || !m->globs || !fail || !order) {
+        perror("malloc");
+        exit(1);
+    }
+    memset(m->delta, 0xff, 256 * sizeof(int32_t));
+    m->numStates = 1;
+
+    // Build the trie of plain patterns (-1 = no edge yet).
+    for (int i = 0; i < numPatterns; i++) {
+        const char *pat = patterns[i];
+        if (strpbrk(pat, "*?[")) {
+            char *copy = strdup(pat);
+            if (!copy) {
+                perror("strdup");
+                exit(1);
+            }
+            if (parse_ignore_rule(copy, &m->globs[m->numGlobs]) && !m->globs[m->numGlobs].negate)
+                m->numGlobs++;
+            free(copy);
+            continue;
+        }
+        int32_t state = 0;
+        for (const unsigned char *c = (const unsigned char *) pat; *c; c++) {
+            int32_t *next = &m->delta[(size_t) state * 256 + *c];
+            if (*next < 0) {
+                *next = m->numStates;
+                memset(&m->delta[(size_t) m->numStates * 256], 0xff, 256 * sizeof(int32_t));
+                m->numStates++;
+            }
+            state = *next;
+        }
+        m->accept[state] = 1;
+    }
+
+    // Breadth-first: fill in missing edges from the failure links so every
+    // state has a transition on every byte.
+    size_t head = 0, tail = 0;
+    for (int c = 0; c < 256; c++) {
+        int32_t next = m->delta[c];
+        if (next < 0) {
+            m->delta[c] = 0;
+        } else {
+            fail[next] = 0;
+            order[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        int32_t state = order[head++];
+        m->accept[state] |= m->accept[fail[state]];
+        for (int c = 0; c < 256; c++) {
+            int32_t *next = &m->delta[(size_t) state * 256 + c];
+            int32_t viaFail = m->delta[(size_t) fail[state] * 256 + c];
+            if (*next < 0) {
+                *next = viaFail;
+            } else {
+                fail[*next] = viaFail;
+                order[tail++] = *next;
+            }
+        }
+    }
+    free(fail);
+    free(order);
+    return m;
+}
+
+void exclude_free(ExcludeMatcher *m) {
+    if (!m)
+        return;
+    for (int i = 0; i < m->numGlobs; i++)
+        free(m->globs[i].pattern);
+    free(m->globs);
+    free(m->delta);
+    free(m->accept);
+    free(m);
+}
+
+// Feed `s` to the automaton from `state`. Returns the new state, or -1 as
+// soon as some plain pattern has matched.
+int exclude_advance(const ExcludeMatcher *m, int state, const char *s) {
+    if (!m)
+        return 0;
+    if (m->accept[state])
+        return -1;
+    for (const unsigned char *c = (const unsigned char *) s; *c; c++) {
+        state = m->delta[(size_t) state * 256 + *c];
+        if (m->accept[state])
+            return -1;
+    }
+    return state;
+}
+
+int exclude_glob_match(const ExcludeMatcher *m, const char *relPath, const char *name, int isDir) {
+    if (!m)
+        return 0;
+    for (int i = 0; i < m->numGlobs; i++) {
+        if (rule_matches(&m->globs[i], relPath, name, isDir))
+            return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// --gitignore: the .gitignore of every directory on the current path, most
+// nested first. Read the .gitignore in the directory open at `dirfd` and push
+// it on `parent` (taking a new reference); returns `parent` itself, with an
+// extra reference, if there is nothing to add.
+// ---------------------------------------------------------------------------
+IgnoreList *ignore_list_load(int dirfd, IgnoreList *parent, size_t baseLen) {
+    int fd = openat(dirfd, ".gitignore", O_RDONLY | O_CLOEXEC);
+    char *text = NULL;
+    size_t len = 0, cap = 0;
+    if (fd >= 0) {
+        for (;;) {
+            text = grow_array(text, &cap, len + 4096 + 1, 1);
+            ssize_t n = read(fd, text + len, 4096);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            len += (size_t) n;
+        }
+        close(fd);
+    }
+    IgnoreRule *rules = NULL;
+    size_t numRules = 0, capRules = 0;
+    if (text) {
+        text[len] = '\0';
+        for (char *line = text; line && *line;) {
+            char *next = strchr(line, '\n');
+            if (next)
+                *next++ = '\0';
+            rules = grow_array(rules, &capRules, numRules + 1, sizeof(IgnoreRule));
+            if (parse_ignore_rule(line, &rules[numRules]))
+                numRules++;
+            line = next;
+        }
+        free(text);
+    }
+    if (numRules == 0) {
+        free(rules);
+        if (parent)
+            atomic_fetch_add(&parent->refs, 1);
+        return parent;
+    }
+    IgnoreList *list = malloc(sizeof(IgnoreList));
+    if (!list) {
+        perror("malloc");
+        exit(1);
+    }
+    list->parent = parent;
+    if (parent)
+        atomic_fetch_add(&parent->refs, 1);
+    list->baseLen = baseLen;
+    list->rules = rules;
+    list->numRules = (int) numRules;
+    atomic_init(&list->refs, 1);
+    return list;
+}
+
+// Git semantics: the last matching rule of the most nested .gitignore
+// decides, and "!pattern" re-includes. `path` is the walker's full path.
+int ignore_list_match(const IgnoreList *list, const char *path, const char *name, int isDir) {
+    for (; list; list = list->parent) {
+        const char *relPath = path + list->baseLen + 1;
+        for (int i = list->numRules - 1; i >= 0; i--) {
+            if (rule_matches(&list->rules[i], relPath, name, isDir))
+                return !list->rules[i].negate;
+        }
+    }
+    return 0;
+}
+
+void ignore_list_release(IgnoreList *list) {
+    while (list && atomic_fetch_sub(&list->refs, 1) == 1) {
+        IgnoreList *parent = list->parent;
+        for (int i = 0; i < list->numRules; i++)
+            free(list->rules[i].pattern);
+        free(list->rules);
+        free(list);
+        list = parent;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// --profile instrumentation.
+// Every walker thread points threadProfile at its own counters for the
+// duration of the scan, so the I/O functions can time their system calls
+// without taking a ScanState. Without --profile the pointer is NULL and each
+// probe is a single branch.
+// ---------------------------------------------------------------------------
+static _Thread_local ScanProfile *threadProfile;
+
+static const char *phaseNames[NUM_PHASES] = {
+    "open dir", "readdir", "stat", "open", "read", "count", "close", "io_uring"
+};
+
+static unsigned long long profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+// Start timestamp for a probe; 0 when not profiling.
+static inline unsigned long long profile_start(void) {
+    return threadProfile ? profile_now() : 0;
+}
+
+// Charge the time since `start` and `calls` calls to `phase`. Returns the
+// current time so consecutive phases can be chained.
+static inline unsigned long long profile_phase(ProfilePhase phase, unsigned long long start, unsigned calls) {
+    if (!threadProfile)
+        return 0;
+    unsigned long long now = profile_now();
+    threadProfile->phases[phase].ns += now - start;
+    threadProfile->phases[phase].calls += calls;
+    return now;
+}
+
+static int log2_bucket(unsigned long long v) {
+    return v == 0 ? 0 : 64 - __builtin_clzll(v);
+}
+
+// Keep `path` in the slowest-first list `list` if it is among the slowest.
+static void profile_slow_insert(SlowEntry *list, int *count, unsigned long long ns, const char *path, int takePath) {
+    if (*count == PROFILE_TOP && ns <= list[PROFILE_TOP - 1].ns) {
+        if (takePath)
+            free((char *) path);
+        return;
+    }
+    if (*count == PROFILE_TOP)
+        free(list[--*count].path);
+    int i = *count;
+    for (; i > 0 && list[i - 1].ns < ns; i--)
+        list[i] = list[i - 1];
+    list[i].ns = ns;
+    list[i].path = takePath ? (char *) path : strdup(path);
+    if (!list[i].path) {
+        perror("strdup");
+        exit(1);
+    }
+    (*count)++;
+}
+
+// Record a counted file: its size, and for files that were actually read
+// (latencyNs > 0) how long that took from open to close.
+static void profile_file(ScanProfile *p, const char *path, long long bytes, unsigned long long latencyNs) {
+    p->sizeHist[log2_bucket((unsigned long long) bytes)]++;
+    if (latencyNs == 0)
+        return;
+    p->latencyHist[log2_bucket(latencyNs)]++;
+    profile_slow_insert(p->slowFiles, &p->numSlowFiles, latencyNs, path, 0);
+}
+
+static void profile_dir(ScanProfile *p, const char *path, unsigned long long ns) {
+    profile_slow_insert(p->slowDirs, &p->numSlowDirs, ns, path, 0);
+}
+
+// Add the counters of `src` to `dst`; `src` gives up its slow-entry paths.
+void profile_merge(ScanProfile *dst, ScanProfile *src) {
+    for (int i = 0; i < NUM_PHASES; i++) {
+        dst->phases[i].ns += src->phases[i].ns;
+        dst->phases[i].calls += src->phases[i].calls;
+    }
+    dst->bytesRead += src->bytesRead;
+    dst->ringRequests += src->ringRequests;
+    for (int i = 0; i < PROFILE_HIST_BUCKETS; i++) {
+        dst->sizeHist[i] += src->sizeHist[i];
+        dst->latencyHist[i] += src->latencyHist[i];
+    }
+    for (int i = 0; i < src->numSlowFiles; i++)
+        profile_slow_insert(dst->slowFiles, &dst->numSlowFiles, src->slowFiles[i].ns, src->slowFiles[i].path, 1);
+    for (int i = 0; i < src->numSlowDirs; i++)
+        profile_slow_insert(dst->slowDirs, &dst->numSlowDirs, src->slowDirs[i].ns, src->slowDirs[i].path, 1);
+    src->numSlowFiles = src->numSlowDirs = 0;
+}
+
+void profile_free(ScanProfile *p) {
+    if (!p)
+        return;
+    for (int i = 0; i < p->numSlowFiles; i++)
+        free(p->slowFiles[i].path);
+    for (int i = 0; i < p->numSlowDirs; i++)
+        free(p->slowDirs[i].path);
+    free(p);
+}
+
+static void format_duration(unsigned long long ns, char *buffer, size_t buflen) {
+    if (ns < 1000ULL)
+        snprintf(buffer, buflen, "%llu ns", ns);
+    else if (ns < 1000000ULL)
+        snprintf(buffer, buflen, "%.1f us", ns / 1e3);
+    else if (ns < 1000000000ULL)
+        snprintf(buffer, buflen, "%.1f ms", ns / 1e6);
+    else
+        snprintf(buffer, buflen, "%.2f s", ns / 1e9);
+}
+
+static unsigned long long profile_syscalls(const ScanProfile *p) {
+    unsigned long long total = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        if (i != PHASE_COUNT)
+            total += p->phases[i].calls;
+    }
+    return total;
+}
+
+// One histogram row per bucket between the first and last non-empty one.
+// Bucket b holds values in [2^(b-1), 2^b).
+static void print_histogram(FILE *out, const unsigned long long *hist, int isTime, int ascii) {
+    int first = 0, last = PROFILE_HIST_BUCKETS - 1;
+    while (first <= last && hist[first] == 0)
+        first++;
+    while (last >= first && hist[last] == 0)
+        last--;
+    unsigned long long max = 0;
+    for (int b = first; b <= last; b++) {
+        if (hist[b] > max)
+            max = hist[b];
+    }
+    for (int b = first; b <= last; b++) {
+        char lo[16], hi[16];
+        unsigned long long from = b == 0 ? 0 : 1ULL << (b - 1);
+        unsigned long long to = b == 0 ? 1 : (b < 64 ? 1ULL << b : ~0ULL);
+        if (isTime) {
+            format_duration(from, lo, sizeof(lo));
+            format_duration(to, hi, sizeof(hi));
+        } else {
+            dirstat_format_size((long long) from, lo, sizeof(lo));
+            dirstat_format_size((long long) to, hi, sizeof(hi));
+        }
+        int len = (int) ((hist[b] * 40 + max - 1) / max);
+        fprintf(out, "  %10s - %-10s %10llu  ", lo, hi, hist[b]);
+        for (int i = 0; i < len; i++)
+            fputs(ascii ? "#" : "█", out);
+        fprintf(out, "\n");
+    }
+}
+
+static void print_slow_entries(FILE *out, const SlowEntry *list, int count) {
+    for (int i = 0; i < count; i++) {
+        char t[16];
+        format_duration(list[i].ns, t, sizeof(t));
+        fprintf(out, "  %10s  %s\n", t, list[i].path);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// The profile report: dirstat_print_profile, after the normal statistics.
+// Phase times are summed over all walker threads, so with --jobs they can add
+// up to more than the wall time.
+// ---------------------------------------------------------------------------
+void profile_print(FILE *out, const ScanProfile *p, double wallSec, const struct rusage *usage, int jobs, int ascii) {
+    unsigned long long totalNs = 0;
+    for (int i = 0; i < NUM_PHASES; i++)
+        totalNs += p->phases[i].ns;
+    char bytes[16];
+    dirstat_format_size((long long) p->bytesRead, bytes, sizeof(bytes));
+    fprintf(out, "\nProfile (%d thread%s)\n", jobs, jobs == 1 ? "" : "s");
+    fprintf(out, "-------------------------------------------------------------------------------\n");
+    fprintf(out, "Wall time: %.3f s   User CPU: %.3f s   System CPU: %.3f s\n", wallSec,
+           usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+           usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6);
+    fprintf(out, "System calls: %llu   Bytes read: %s", profile_syscalls(p), bytes);
+    if (p->ringRequests > 0)
+        fprintf(out, "   io_uring requests: %llu", p->ringRequests);
+    fprintf(out, "\n\n%-10s %12s %12s %8s\n", "Phase", "Calls", "Time", "Share");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        if (p->phases[i].calls == 0 && p->phases[i].ns == 0)
+            continue;
+        char t[16];
+        format_duration(p->phases[i].ns, t, sizeof(t));
+        fprintf(out, "%-10s %12llu %12s %7.1f%%\n", phaseNames[i], p->phases[i].calls, t,
+               totalNs ? p->phases[i].ns * 100.0 / totalNs : 0.0);
+    }
+    fprintf(out, "\nFile sizes:\n");
+    print_histogram(out, p->sizeHist, 0, ascii);
+    fprintf(out, "\nPer-file latency (open to close):\n");
+    print_histogram(out, p->latencyHist, 1, ascii);
+    fprintf(out, "\nSlowest files:\n");
+    print_slow_entries(out, p->slowFiles, p->numSlowFiles);
+    fprintf(out, "\nSlowest directories (open and list):\n");
+    print_slow_entries(out, p->slowDirs, p->numSlowDirs);
+}
+
+// Write `s` as a JSON string literal.
+void dirstat_json_print_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *) s; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            fprintf(out, "\\%c", *c);
+        else if (*c < 0x20)
+            fprintf(out, "\\u%04x", *c);
+        else
+            fputc(*c, out);
+    }
+    fputc('"', out);
+}
+
+static void json_print_histogram(FILE *out, const unsigned long long *hist) {
+    int first = 1;
+    fputc('[', out);
+    for (int b = 0; b < PROFILE_HIST_BUCKETS; b++) {
+        if (hist[b] == 0)
+            continue;
+        fprintf(out, "%s{\"min\":%llu,\"count\":%llu}", first ? "" : ",", b == 0 ? 0 : 1ULL << (b - 1), hist[b]);
+        first = 0;
+    }
+    fputc(']', out);
+}
+
+static void json_print_slow_entries(FILE *out, const SlowEntry *list, int count) {
+    fputc('[', out);
+    for (int i = 0; i < count; i++) {
+        fprintf(out, "%s{\"ns\":%llu,\"path\":", i ? "," : "", list[i].ns);
+        dirstat_json_print_string(out, list[i].path);
+        fputc('}', out);
+    }
+    fputc(']', out);
+}
+
+// --profile=json: the same report as one JSON object.
+void profile_print_json(FILE *out, const ScanProfile *p, double wallSec, const struct rusage *usage, int jobs) {
+    fprintf(out, "{\"threads\":%d,\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f,", jobs, wallSec,
+            usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+            usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6);
+    fprintf(out, "\"syscalls\":%llu,\"bytes_read\":%llu,\"uring_requests\":%llu,\"phases\":{",
+            profile_syscalls(p), p->bytesRead, p->ringRequests);
+    for (int i = 0; i < NUM_PHASES; i++)
+        fprintf(out, "%s\"%s\":{\"calls\":%llu,\"ns\":%llu}", i ? "," : "", phaseNames[i],
+                p->phases[i].calls, p->phases[i].ns);
+    fprintf(out, "},\"file_sizes\":");
+    json_print_histogram(out, p->sizeHist);
+    fprintf(out, ",\"file_latency_ns\":");
+    json_print_histogram(out, p->latencyHist);
+    fprintf(out, ",\"slowest_files\":");
+    json_print_slow_entries(out, p->slowFiles, p->numSlowFiles);
+    fprintf(out, ",\"slowest_dirs\":");
+    json_print_slow_entries(out, p->slowDirs, p->numSlowDirs);
+    fprintf(out, "}\n");
+}
+
+// ---------------------------------------------------------------------------
+// Newline counting kernels.
+// The SIMD variants compare 16/32/64 bytes at a time against '\n'. SSE2/AVX2
+// accumulate the 0/-1 compare results in per-byte counters for up to 255
+// blocks before folding them with SAD, so the inner loop has no horizontal
+// work. The best kernel for the running CPU is picked once at first use.
+// ---------------------------------------------------------------------------
+static size_t count_newlines_scalar(const unsigned char *buf, size_t len) {
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+        count += (buf[i] == '\n');
+    return count;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static size_t count_newlines_sse2(const unsigned char *buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    while (len - i >= 16) {
+        size_t blocks = (len - i) / 16;
+        if (blocks > 255)
+            blocks = 255;
+        __m128i acc = _mm_setzero_si128();
+        for (size_t b = 0; b < blocks; b++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_extract_epi16(sums, 0) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const unsigned char *buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    while (len - i >= 32) {
+        size_t blocks = (len - i) / 32;
+        if (blocks > 255)
+            blocks = 255;
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t b = 0; b < blocks; b++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+        }
+        __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        count += (size_t)_mm256_extract_epi16(sums, 0) + (size_t)_mm256_extract_epi16(sums, 4) +
+                 (size_t)_mm256_extract_epi16(sums, 8) + (size_t)_mm256_extract_epi16(sums, 12);
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+
+__attribute__((target("avx512bw,popcnt")))
+static size_t count_newlines_avx512(const unsigned char *buf, size_t len) {
+    const __m512i nl = _mm512_set1_epi8('\n');
+    size_t count = 0, i = 0;
+    for (; len - i >= 64; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(buf + i));
+        count += (size_t)__builtin_popcountll(_mm512_cmpeq_epi8_mask(v, nl));
+    }
+    return count + count_newlines_scalar(buf + i, len - i);
+}
+#endif
+
+static size_t (*count_newlines)(const unsigned char *buf, size_t len) = count_newlines_scalar;
+static pthread_once_t countNewlinesOnce = PTHREAD_ONCE_INIT;
+
+static void select_newline_kernel(void) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("popcnt"))
+        count_newlines = count_newlines_avx512;
+    else if (__builtin_cpu_supports("avx2"))
+        count_newlines = count_newlines_avx2;
+    else if (__builtin_cpu_supports("sse2"))
+        count_newlines = count_newlines_sse2;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Line classification (DirstatOptions.classify).
+// Every '\n'-terminated line of a file in a known language is code if it has
+// anything but whitespace outside comments (string contents are code),
+// comment if it has comment text or delimiters only, and blank otherwise.
+// The rules of a language family are a constant LangRule; lex_classify is
+// always inlined into one classifier per family, so the compiler folds the
+// rule into the code. It looks at 64 bytes at a time: with SSE2 a handful of
+// compares give bit masks of the newlines, delimiter and quote bytes and
+// non-whitespace of the block, and the lexer jumps straight from one such
+// byte to the next instead of stepping through every byte.
+// ---------------------------------------------------------------------------
+
+// Longest comment delimiter of any rule
+#define LEX_MAX_DELIM 4
+
+// Bytes the lexer looks at at a time, one bit each in a LexMasks
+#define LEX_BLOCK 64
+
+typedef struct {
+    char line[2][LEX_MAX_DELIM + 1];   // line comment openers, "" if unused
+    char blockOpen[LEX_MAX_DELIM + 1]; // block comment delimiters, "" if none
+    char blockClose[LEX_MAX_DELIM + 1];
+    int nested;                        // block comments nest
+    char quotes[4];                    // string delimiters
+    char spanQuotes[4];                // those whose strings go on past the end of a line
+    char escape;                       // escapes the next byte in a string, 0 if none
+} LangRule;
+
+typedef enum {
+    LEX_CODE = 0,
+    LEX_LINE_COMMENT,
+    LEX_BLOCK_COMMENT,
+    LEX_STRING
+} LexState;
+
+// Where the lexer is in a file, carried from one block read to the next;
+// zeroed at the start of a file.
+typedef struct {
+    unsigned char state;             // LexState
+    unsigned char quote;             // LEX_STRING: the byte that ends it
+    unsigned char hasCode, hasComment;   // seen on the current line so far
+    int depth;                       // LEX_BLOCK_COMMENT: nesting depth
+    unsigned char held[LEX_MAX_DELIM];   // possible delimiter cut off by the end of the last block
+    int numHeld;
+} LineState;
+
+struct Language {
+    const char *ext;    // lowercase
+    const char *name;
+    void (*classify)(LineState *ls, const unsigned char *buf, size_t len, DirstatFileStats *s);
+};
+
+// Per-block bit masks; bit i stands for byte i of the block. `special`
+// has the bytes any state may stop at: newlines and the first bytes of
+// delimiters, quotes and escapes. `text` has all but whitespace, which is
+// every byte up to ' ' here.
+typedef struct {
+    uint64_t newline, special, text;
+} LexMasks;
+
+#define LEX_INLINE static inline __attribute__((always_inline))
+
+// The rule's strings are only ever indexed with constants, written out, so
+// that they fold into immediates; loops over them are not unrolled at -O2.
+LEX_INLINE int lex_is_quote(const char quotes[4], unsigned char c) {
+    return (quotes[0] && c == (unsigned char) quotes[0]) || (quotes[1] && c == (unsigned char) quotes[1]) ||
+           (quotes[2] && c == (unsigned char) quotes[2]);
+}
+
+LEX_INLINE int lex_is_special(const LangRule *r, unsigned char c) {
+    return (r->line[0][0] && c == (unsigned char) r->line[0][0]) ||
+           (r->line[1][0] && c == (unsigned char) r->line[1][0]) ||
+           (r->blockOpen[0] && c == (unsigned char) r->blockOpen[0]) ||
+           (r->blockClose[0] && c == (unsigned char) r->blockClose[0]) || lex_is_quote(r->quotes, c) ||
+           (r->escape && c == (unsigned char) r->escape);
+}
+
+#ifdef __SSE2__
+LEX_INLINE __m128i lex_eq_sse2(__m128i v, char c) {
+    return c ? _mm_cmpeq_epi8(v, _mm_set1_epi8(c)) : _mm_setzero_si128();
+}
+#endif
+
+// Masks of the n <= LEX_BLOCK bytes at p.
+LEX_INLINE void lex_masks(const LangRule *r, const unsigned char *p, size_t n, LexMasks *m) {
+#ifdef __SSE2__
+    if (n == LEX_BLOCK) {
+        m->newline = m->special = m->text = 0;
+        for (int i = 0; i < LEX_BLOCK / 16; i++) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * i));
+            __m128i newline = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+            __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(lex_eq_sse2(v, r->line[0][0]), lex_eq_sse2(v, r->line[1][0])),
+                             _mm_or_si128(lex_eq_sse2(v, r->blockOpen[0]), lex_eq_sse2(v, r->blockClose[0]))),
+                _mm_or_si128(_mm_or_si128(lex_eq_sse2(v, r->quotes[0]), lex_eq_sse2(v, r->quotes[1])),
+                             _mm_or_si128(lex_eq_sse2(v, r->quotes[2]), lex_eq_sse2(v, r->escape))));
+            __m128i text = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(' ' + 1)), v);
+            m->newline |= (uint64_t) (unsigned) _mm_movemask_epi8(newline) << (16 * i);
+            m->special |= (uint64_t) (unsigned) _mm_movemask_epi8(_mm_or_si128(special, newline)) << (16 * i);
+            m->text |= (uint64_t) (unsigned) _mm_movemask_epi8(text) << (16 * i);
+        }
+        return;
+    }
+#endif
+    m->newline = m->special = m->text = 0;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        uint64_t bit = 1ull << i;
+        if (c == '\n')
+            m->newline |= bit;
+        if (c == '\n' || lex_is_special(r, c))
+            m->special |= bit;
+        if (c > ' ')
+            m->text |= bit;
+    }
+}
+
+// Length of delimiter `d` if it starts at p, else 0. Sets *cut if the
+// `avail` bytes left are a prefix of it, so only the next block can tell.
+LEX_INLINE size_t lex_match(const unsigned char *p, size_t avail, const char d[LEX_MAX_DELIM + 1], int *cut) {
+#define LEX_MATCH_BYTE(i) \
+    if (!d[i]) \
+        return i; \
+    if (avail == i) { \
+        *cut = 1; \
+        return 0; \
+    } \
+    if (p[i] != (unsigned char) d[i]) \
+        return 0;
+    LEX_MATCH_BYTE(0)
+    LEX_MATCH_BYTE(1)
+    LEX_MATCH_BYTE(2)
+    LEX_MATCH_BYTE(3)
+#undef LEX_MATCH_BYTE
+    return LEX_MAX_DELIM;
+}
+
+LEX_INLINE void lex_end_line(const LangRule *r, LineState *ls, DirstatFileStats *s) {
+    s->lines++;
+    if (ls->hasCode)
+        s->codeLines++;
+    else if (ls->hasComment)
+        s->commentLines++;
+    else
+        s->blankLines++;
+    ls->hasCode = ls->hasComment = 0;
+    if (ls->state == LEX_LINE_COMMENT || (ls->state == LEX_STRING && !lex_is_quote(r->spanQuotes, ls->quote)))
+        ls->state = LEX_CODE;
+}
+
+// Handle the byte at buf[at], one the current state cares about. Returns
+// where to go on, or `at` itself if a delimiter may be cut off at the end.
+LEX_INLINE size_t lex_step(const LangRule *r, LineState *ls, const unsigned char *buf, size_t len, size_t at,
+                           DirstatFileStats *s) {
+    unsigned char c = buf[at];
+    size_t avail = len - at, k;
+    int cut = 0;
+    if (c == '\n') {
+        lex_end_line(r, ls, s);
+        return at + 1;
+    }
+    switch (ls->state) {
+    case LEX_CODE:
+        // Block openers first: Lua's --[[ starts with the line opener --
+        if (r->blockOpen[0] && (k = lex_match(buf + at, avail, r->blockOpen, &cut))) {
+            ls->state = LEX_BLOCK_COMMENT;
+            ls->depth = 1;
+            ls->hasComment = 1;
+            return at + k;
+        }
+        if (cut)
+            return at;
+        if ((r->line[0][0] && (k = lex_match(buf + at, avail, r->line[0], &cut))) ||
+            (r->line[1][0] && (k = lex_match(buf + at, avail, r->line[1], &cut)))) {
+            ls->state = LEX_LINE_COMMENT;
+            ls->hasComment = 1;
+            return at + k;
+        }
+        if (cut)
+            return at;
+        if (lex_is_quote(r->quotes, c)) {
+            ls->state = LEX_STRING;
+            ls->quote = c;
+        }
+        ls->hasCode = 1;
+        return at + 1;
+    case LEX_BLOCK_COMMENT:
+        ls->hasComment = 1;
+        if ((k = lex_match(buf + at, avail, r->blockClose, &cut))) {
+            if (--ls->depth == 0)
+                ls->state = LEX_CODE;
+            return at + k;
+        }
+        if (r->nested && !cut && (k = lex_match(buf + at, avail, r->blockOpen, &cut))) {
+            ls->depth++;
+            return at + k;
+        }
+        return cut ? at : at + 1;
+    case LEX_STRING:
+        ls->hasCode = 1;
+        if (r->escape && c == (unsigned char) r->escape) {
+            if (avail < 2)
+                return at;
+            return at + (buf[at + 1] == '\n' ? 1 : 2);
+        }
+        if (c == ls->quote)
+            ls->state = LEX_CODE;
+        return at + 1;
+    default:
+        return at + 1;
+    }
+}
+
+// Classify buf[0..len); returns how much of it was used (less than len if
+// it ends in a possibly cut-off delimiter).
+LEX_INLINE size_t lex_run(const LangRule *r, LineState *ls, const unsigned char *buf, size_t len, DirstatFileStats *s) {
+    size_t pos = 0;
+    for (size_t base = 0; base < len; base += LEX_BLOCK) {
+        size_t n = len - base < LEX_BLOCK ? len - base : LEX_BLOCK;
+        LexMasks m;
+        lex_masks(r, buf + base, n, &m);
+        while (pos < base + n) {
+            uint64_t from = ~0ull << (pos - base);
+            // A special byte may not matter in the current state; lex_step
+            // then just goes on after it.
+            uint64_t stops = (ls->state == LEX_LINE_COMMENT ? m.newline : m.special) & from;
+            size_t stop = stops ? (size_t) __builtin_ctzll(stops) : n;
+            // The text from pos up to the stop (or the end of the block)
+            if (m.text & from & (stops ? (stops & -stops) - 1 : ~0ull)) {
+                if (ls->state == LEX_LINE_COMMENT || ls->state == LEX_BLOCK_COMMENT)
+                    ls->hasComment = 1;
+                else
+                    ls->hasCode = 1;
+            }
+            if (stop == n) {
+                pos = base + n;
+                break;
+            }
+            size_t next = lex_step(r, ls, buf, len, base + stop, s);
+            if (next == base + stop)
+                return next;
+            pos = next;
+        }
+    }
+    return len;
+}
+
+// Classify the next block of a file, first finishing a delimiter the last
+// block cut off. At most LEX_MAX_DELIM - 1 bytes are ever held back.
+LEX_INLINE void lex_classify(const LangRule *r, LineState *ls, const unsigned char *buf, size_t len,
+                             DirstatFileStats *s) {
+    size_t i = 0;
+    if (ls->numHeld > 0) {
+        unsigned char joined[LEX_BLOCK];   // at most 2 * LEX_MAX_DELIM - 1 bytes are used
+        size_t held = (size_t) ls->numHeld, take = len < LEX_MAX_DELIM ? len : LEX_MAX_DELIM;
+        memcpy(joined, ls->held, held);
+        memcpy(joined + held, buf, take);
+        ls->numHeld = 0;
+        size_t used = lex_run(r, ls, joined, held + take, s);
+        if (used < held) {
+            // Only possible if all of buf fit in `joined`
+            ls->numHeld = (int) (held + take - used);
+            memcpy(ls->held, joined + used, (size_t) ls->numHeld);
+            return;
+        }
+        i = used - held;
+    }
+    size_t used = i + lex_run(r, ls, buf + i, len - i, s);
+    ls->numHeld = (int) (len - used);
+    memcpy(ls->held, buf + used, len - used);
+}
+
+// Language families
+static const LangRule ruleC = {{"//", ""}, "/*", "*/", 0, "\"'", "", '\\'};
+static const LangRule ruleCSpan = {{"//", ""}, "/*", "*/", 0, "\"'", "\"'", '\\'};
+static const LangRule ruleJs = {{"//", ""}, "/*", "*/", 0, "\"'`", "`", '\\'};
+static const LangRule ruleRust = {{"//", ""}, "/*", "*/", 1, "\"", "\"", '\\'};
+static const LangRule ruleCss = {{"", ""}, "/*", "*/", 0, "\"'", "", '\\'};
+static const LangRule rulePhp = {{"//", "#"}, "/*", "*/", 0, "\"'", "\"'", '\\'};
+static const LangRule ruleHash = {{"#", ""}, "", "", 0, "\"'", "\"'", '\\'};
+static const LangRule ruleConfig = {{"#", ""}, "", "", 0, "\"'", "", '\\'};
+static const LangRule rulePowerShell = {{"#", ""}, "<#", "#>", 0, "\"'", "\"'", '`'};
+static const LangRule ruleJulia = {{"#", ""}, "#=", "=#", 1, "\"", "\"", '\\'};
+static const LangRule ruleSql = {{"--", ""}, "/*", "*/", 0, "'\"", "'", 0};
+static const LangRule ruleLua = {{"--", ""}, "--[[", "]]", 0, "\"'", "", '\\'};
+static const LangRule ruleHaskell = {{"--", ""}, "{-", "-}", 1, "\"", "", '\\'};
+static const LangRule ruleAda = {{"--", ""}, "", "", 0, "\"", "", 0};
+static const LangRule ruleSemicolon = {{";", ""}, "", "", 0, "\"", "\"", '\\'};
+static const LangRule rulePercent = {{"%", ""}, "", "", 0, "", "", 0};
+static const LangRule ruleMl = {{"", ""}, "(*", "*)", 1, "\"", "\"", '\\'};
+static const LangRule ruleXml = {{"", ""}, "<!--", "-->", 0, "", "", 0};
+static const LangRule ruleJson = {{"", ""}, "", "", 0, "\"", "", '\\'};
+static const LangRule ruleFortran = {{"!", ""}, "", "", 0, "\"'", "", 0};
+
+#define LANGUAGE_CLASSIFIER(fn, rule) \
+    static void fn(LineState *ls, const unsigned char *buf, size_t len, DirstatFileStats *s) { \
+        lex_classify(&rule, ls, buf, len, s); \
+    }
+
+LANGUAGE_CLASSIFIER(lex_c, ruleC)
+LANGUAGE_CLASSIFIER(lex_cspan, ruleCSpan)
+LANGUAGE_CLASSIFIER(lex_js, ruleJs)
+LANGUAGE_CLASSIFIER(lex_rust, ruleRust)
+LANGUAGE_CLASSIFIER(lex_css, ruleCss)
+LANGUAGE_CLASSIFIER(lex_php, rulePhp)
+LANGUAGE_CLASSIFIER(lex_hash, ruleHash)
+LANGUAGE_CLASSIFIER(lex_config, ruleConfig)
+LANGUAGE_CLASSIFIER(lex_powershell, rulePowerShell)
+LANGUAGE_CLASSIFIER(lex_julia, ruleJulia)
+LANGUAGE_CLASSIFIER(lex_sql, ruleSql)
+LANGUAGE_CLASSIFIER(lex_lua, ruleLua)
+LANGUAGE_CLASSIFIER(lex_haskell, ruleHaskell)
+LANGUAGE_CLASSIFIER(lex_ada, ruleAda)
+LANGUAGE_CLASSIFIER(lex_semicolon, ruleSemicolon)
+LANGUAGE_CLASSIFIER(lex_percent, rulePercent)
+LANGUAGE_CLASSIFIER(lex_ml, ruleMl)
+LANGUAGE_CLASSIFIER(lex_xml, ruleXml)
+LANGUAGE_CLASSIFIER(lex_json, ruleJson)
+LANGUAGE_CLASSIFIER(lex_fortran, ruleFortran)
+
+// Known extensions, sorted for bsearch
+static const Language languages[] = {
+    {"adb", "Ada", lex_ada}, {"ads", "Ada", lex_ada}, {"asm", "Assembly", lex_semicolon},
+    {"bash", "Shell", lex_hash}, {"c", "C", lex_c}, {"c++", "C++", lex_c}, {"cc", "C++", lex_c},
+    {"cjs", "JavaScript", lex_js}, {"clj", "Clojure", lex_semicolon}, {"cljc", "Clojure", lex_semicolon},
+    {"cljs", "Clojure", lex_semicolon}, {"cmake", "CMake", lex_config}, {"cpp", "C++", lex_c}, {"cs", "C#", lex_c},
+    {"css", "CSS", lex_css}, {"cts", "TypeScript", lex_js}, {"cu", "CUDA", lex_c}, {"cuh", "CUDA", lex_c},
+    {"cxx", "C++", lex_c}, {"dart", "Dart", lex_cspan}, {"edn", "Clojure", lex_semicolon},
+    {"el", "Emacs Lisp", lex_semicolon}, {"elm", "Elm", lex_haskell}, {"erl", "Erlang", lex_percent},
+    {"ex", "Elixir", lex_hash}, {"exs", "Elixir", lex_hash}, {"f03", "Fortran", lex_fortran},
+    {"f08", "Fortran", lex_fortran}, {"f90", "Fortran", lex_fortran}, {"f95", "Fortran", lex_fortran},
+    {"fish", "Shell", lex_hash}, {"frag", "GLSL", lex_c}, {"glsl", "GLSL", lex_c}, {"go", "Go", lex_js},
+    {"gradle", "Groovy", lex_c}, {"groovy", "Groovy", lex_c}, {"h", "C/C++ Header", lex_c},
+    {"h++", "C/C++ Header", lex_c}, {"hh", "C/C++ Header", lex_c}, {"hlsl", "HLSL", lex_c},
+    {"hpp", "C/C++ Header", lex_c}, {"hrl", "Erlang", lex_percent}, {"hs", "Haskell", lex_haskell},
+    {"htm", "HTML", lex_xml}, {"html", "HTML", lex_xml}, {"hxx", "C/C++ Header", lex_c}, {"inl", "C++", lex_c},
+    {"ipp", "C++", lex_c}, {"java", "Java", lex_c}, {"jl", "Julia", lex_julia}, {"js", "JavaScript", lex_js},
+    {"json", "JSON", lex_json}, {"jsx", "JavaScript", lex_js}, {"ksh", "Shell", lex_hash}, {"kt", "Kotlin", lex_c},
+    {"kts", "Kotlin", lex_c}, {"less", "LESS", lex_c}, {"lisp", "Lisp", lex_semicolon}, {"lua", "Lua", lex_lua},
+    {"m", "Objective-C", lex_c}, {"mjs", "JavaScript", lex_js}, {"ml", "OCaml", lex_ml}, {"mli", "OCaml", lex_ml},
+    {"mm", "Objective-C++", lex_c}, {"mts", "TypeScript", lex_js}, {"nasm", "Assembly", lex_semicolon},
+    {"php", "PHP", lex_php}, {"pl", "Perl", lex_hash}, {"pm", "Perl", lex_hash},
+    {"proto", "Protocol Buffers", lex_c}, {"ps1", "PowerShell", lex_powershell},
+    {"psm1", "PowerShell", lex_powershell}, {"py", "Python", lex_hash}, {"pyi", "Python", lex_hash},
+    {"pyw", "Python", lex_hash}, {"r", "R", lex_hash}, {"rb", "Ruby", lex_hash}, {"rkt", "Racket", lex_semicolon},
+    {"rs", "Rust", lex_rust}, {"scala", "Scala", lex_c}, {"scm", "Scheme", lex_semicolon}, {"scss", "SCSS", lex_c},
+    {"sh", "Shell", lex_hash}, {"sql", "SQL", lex_sql}, {"sty", "TeX", lex_percent}, {"svg", "SVG", lex_xml},
+    {"swift", "Swift", lex_rust}, {"tcc", "C++", lex_c}, {"tex", "TeX", lex_percent}, {"toml", "TOML", lex_config},
+    {"ts", "TypeScript", lex_js}, {"tsx", "TypeScript", lex_js}, {"vert", "GLSL", lex_c}, {"vhd", "VHDL", lex_ada},
+    {"vhdl", "VHDL", lex_ada}, {"xhtml", "HTML", lex_xml}, {"xml", "XML", lex_xml}, {"xsd", "XML", lex_xml},
+    {"xsl", "XSLT", lex_xml}, {"xslt", "XSLT", lex_xml}, {"yaml", "YAML", lex_config}, {"yml", "YAML", lex_config},
+    {"zig", "Zig", lex_c}, {"zsh", "Shell", lex_hash},
+};
+
+static int compare_language(const void *key, const void *lang) {
+    return strcmp((const char *) key, ((const Language *) lang)->ext);
+}
+
+// The language of extension `ext` (any case), or NULL.
+const Language *extension_language(const char *ext) {
+    char lower[16];
+    size_t len = 0;
+    for (; ext[len]; len++) {
+        if (len + 1 == sizeof(lower))
+            return NULL;
+        lower[len] = (char) tolower((unsigned char) ext[len]);
+    }
+    lower[len] = '\0';
+    return bsearch(lower, languages, sizeof(languages) / sizeof(languages[0]), sizeof(Language), compare_language);
+}
+
+// ---------------------------------------------------------------------------
+// Binary files: recognized from their first block, or up front from the
+// extension list. They count with their size only, without lines or
+// characters, and are never read past the first block.
+// ---------------------------------------------------------------------------
+typedef struct {
+    const char *bytes;
+    size_t len;
+} BinaryMagic;
+
+// Magic numbers of formats whose short files may have no NUL byte yet
+static const BinaryMagic binaryMagics[] = {
+    {"\x7f" "ELF", 4},           {"\x89PNG\r\n\x1a\n", 8},     {"\xff\xd8\xff", 3},
+    {"GIF87a", 6},               {"GIF89a", 6},                 {"%PDF-", 5},
+    {"PK\x03\x04", 4},           {"\x1f\x8b", 2},               {"\xfd" "7zXZ", 5},
+    {"\x28\xb5\x2f\xfd", 4},     {"7z\xbc\xaf\x27\x1c", 6},     {"Rar!\x1a\x07", 6},
+    {"\xca\xfe\xba\xbe", 4},     {"\xcf\xfa\xed\xfe", 4},       {"\xce\xfa\xed\xfe", 4},
+    {"RIFF", 4},                 {"OggS", 4},                   {"fLaC", 4},
+    {"!<arch>\n", 8},
+};
+
+// Extensions counted as binary without opening the file (case-insensitive).
+// DirstatOptions.binaryExts adds to these; kept lowercase and sorted for
+// bsearch.
+static const char *defaultBinaryExts[] = {
+    "7z", "a", "apk", "avi", "bin", "bmp", "bz2", "class", "ckpt", "dll", "dmg", "dylib", "eot", "exe",
+    "flac", "gguf", "gif", "gz", "h5", "ico", "iso", "jar", "jpeg", "jpg", "lib", "mkv", "mov", "mp3",
+    "mp4", "npy", "npz", "o", "obj", "ogg", "onnx", "otf", "parquet", "pdf", "png", "pt", "pth",
+    "pyc", "rar", "safetensors", "so", "tar", "tgz", "tif", "tiff", "ttf", "wasm", "wav", "webm",
+    "webp", "whl", "woff", "woff2", "xz", "zip", "zst",
+};
+
+static int compare_binary_ext(const void *a, const void *b) {
+    return strcmp(*(const char *const *) a, *(const char *const *) b);
+}
+
+// Build the scan's extension list from the defaults and `exts` (leading
+// dots allowed), as lowercase copies.
+void binary_exts_init(Dirstat *ds, const char **exts, int numExts) {
+    size_t cap = 0;
+    size_t numDefaults = sizeof(defaultBinaryExts) / sizeof(defaultBinaryExts[0]);
+    for (size_t i = 0; i < numDefaults + (size_t) numExts; i++) {
+        const char *ext = i < numDefaults ? defaultBinaryExts[i] : exts[i - numDefaults];
+        if (*ext == '.')
+            ext++;
+        if (*ext == '\0')
+            continue;
+        char *copy = strdup(ext);
+        if (!copy) {
+            perror("strdup");
+            exit(1);
+        }
+        for (char *c = copy; *c; c++)
+            *c = (char) tolower((unsigned char) *c);
+        ds->binaryExts = grow_array(ds->binaryExts, &cap, ds->numBinaryExts + 1, sizeof(char *));
+        ds->binaryExts[ds->numBinaryExts++] = copy;
+    }
+    qsort(ds->binaryExts, ds->numBinaryExts, sizeof(char *), compare_binary_ext);
+}
+
+int binary_extension(const Dirstat *ds, const char *ext) {
+    if (!ds->opts.binaryDetect || !ds->binaryExts)
+        return 0;
+    char lower[16];
+    size_t len = 0;
+    for (; ext[len]; len++) {
+        if (len + 1 == sizeof(lower))
+            return 0;   // longer than any listed extension worth looking up
+        lower[len] = (char) tolower((unsigned char) ext[len]);
+    }
+    lower[len] = '\0';
+    const char *key = lower;
+    return bsearch(&key, ds->binaryExts, ds->numBinaryExts, sizeof(char *), compare_binary_ext) != NULL;
+}
+
+int binary_block(const unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < sizeof(binaryMagics) / sizeof(binaryMagics[0]); i++) {
+        if (len >= binaryMagics[i].len && memcmp(buf, binaryMagics[i].bytes, binaryMagics[i].len) == 0)
+            return 1;
+    }
+    return memchr(buf, 0, len < BINARY_PROBE_SIZE ? len : BINARY_PROBE_SIZE) != NULL;
+}
+
+// The totals of a binary file of `size` bytes.
+static DirstatFileStats binary_file_stats(long long size) {
+    return (DirstatFileStats){.bytes = size, .binaryFiles = 1, .binaryBytes = size};
+}
+
+// ---------------------------------------------------------------------------
+// Content hashing (--duplicates): XXH64, streamed over the blocks as they
+// are read. Words are loaded native-endian, so the hashes match the
+// reference implementation on little-endian machines; they are only ever
+// compared with hashes from the same machine.
+// ---------------------------------------------------------------------------
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+typedef struct {
+    uint64_t acc[4];
+    uint64_t total;
+    unsigned char buf[32];   // a partial stripe carried to the next update
+    size_t bufLen;
+} Hash64;
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    return xxh_rotl(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t h, uint64_t acc) {
+    return (h ^ xxh_round(0, acc)) * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void hash64_init(Hash64 *h) {
+    h->acc[0] = XXH_PRIME1 + XXH_PRIME2;
+    h->acc[1] = XXH_PRIME2;
+    h->acc[2] = 0;
+    h->acc[3] = -XXH_PRIME1;
+    h->total = 0;
+    h->bufLen = 0;
+}
+
+static void hash64_update(Hash64 *h, const unsigned char *p, size_t len) {
+    h->total += len;
+    if (h->bufLen > 0) {
+        size_t take = 32 - h->bufLen < len ? 32 - h->bufLen : len;
+        memcpy(h->buf + h->bufLen, p, take);
+        h->bufLen += take;
+        p += take;
+        len -= take;
+        if (h->bufLen < 32)
+            return;
+        for (int i = 0; i < 4; i++)
+            h->acc[i] = xxh_round(h->acc[i], xxh_load64(h->buf + 8 * i));
+        h->bufLen = 0;
+    }
+    uint64_t a0 = h->acc[0], a1 = h->acc[1], a2 = h->acc[2], a3 = h->acc[3];
+    for (; len >= 32; p += 32, len -= 32) {
+        a0 = xxh_round(a0, xxh_load64(p));
+        a1 = xxh_round(a1, xxh_load64(p + 8));
+        a2 = xxh_round(a2, xxh_load64(p + 16));
+        a3 = xxh_round(a3, xxh_load64(p + 24));
+    }
+    h->acc[0] = a0, h->acc[1] = a1, h->acc[2] = a2, h->acc[3] = a3;
+    memcpy(h->buf, p, len);
+    h->bufLen = len;
+}
+
+static uint64_t hash64_final(const Hash64 *h) {
+    uint64_t v;
+    if (h->total >= 32) {
+        v = xxh_rotl(h->acc[0], 1) + xxh_rotl(h->acc[1], 7) + xxh_rotl(h->acc[2], 12) + xxh_rotl(h->acc[3], 18);
+        for (int i = 0; i < 4; i++)
+            v = xxh_merge(v, h->acc[i]);
+    } else {
+        v = h->acc[2] + XXH_PRIME5;
+    }
+    v += h->total;
+    const unsigned char *p = h->buf;
+    size_t len = h->bufLen;
+    for (; len >= 8; p += 8, len -= 8)
+        v = xxh_rotl(v ^ xxh_round(0, xxh_load64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+    if (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        v = xxh_rotl(v ^ (uint64_t) w * XXH_PRIME1, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+        len -= 4;
+    }
+    for (; len > 0; p++, len--)
+        v = xxh_rotl(v ^ *p * XXH_PRIME5, 11) * XXH_PRIME1;
+    v ^= v >> 33;
+    v *= XXH_PRIME2;
+    v ^= v >> 29;
+    v *= XXH_PRIME3;
+    return v ^ (v >> 32);
+}
+
+// Hash the head of a file from its first block of `len` bytes. The head
+// hash only picks the files worth hashing in full, so 32 bits are enough.
+static void head_hash(HeadHash *head, const unsigned char *buf, size_t len) {
+    Hash64 h;
+    hash64_init(&h);
+    hash64_update(&h, buf, len < DUP_HEAD_SIZE ? len : DUP_HEAD_SIZE);
+    head->hash = (uint32_t) hash64_final(&h);
+    head->done = 1;
+}
+
+// ---------------------------------------------------------------------------
+// Read an open file in READ_BLOCK_SIZE blocks and count it, up to `limit`
+// bytes. Every byte counts as one character. With detectBinary the first
+// read is only BINARY_PROBE_SIZE bytes; if they are binary the reading stops
+// there and the file counts with its size from fstat. With `lang` the lines
+// are classified as well; with `head` the first block is hashed.
+// ---------------------------------------------------------------------------
+static void count_fd(int fd, DirstatFileStats *s, long long limit, int detectBinary, const Language *lang,
+                     HeadHash *head) {
+    _Alignas(64) unsigned char buf[READ_BLOCK_SIZE];
+    LineState ls = {0};
+    while (s->bytes < limit) {
+        size_t want = limit - s->bytes < (long long) sizeof(buf) ? (size_t) (limit - s->bytes) : sizeof(buf);
+        if (s->bytes == 0 && detectBinary && want > BINARY_PROBE_SIZE)
+            want = BINARY_PROBE_SIZE;
+        unsigned long long t = profile_start();
+        ssize_t n = read(fd, buf, want);
+        t = profile_phase(PHASE_READ, t, 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (n == 0)
+            break;
+        if (threadProfile)
+            threadProfile->bytesRead += (unsigned long long) n;
+        if (s->bytes == 0 && head)
+            head_hash(head, buf, (size_t) n);
+        if (s->bytes == 0 && detectBinary && binary_block(buf, (size_t) n)) {
+            struct stat st;
+            *s = binary_file_stats(fstat(fd, &st) == 0 ? st.st_size : n);
+            profile_phase(PHASE_COUNT, t, 1);
+            return;
+        }
+        s->bytes += n;
+        s->chars += n;
+        if (lang)
+            lang->classify(&ls, buf, (size_t) n, s);
+        else
+            s->lines += (long long) count_newlines(buf, (size_t) n);
+        profile_phase(PHASE_COUNT, t, 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Count lines & characters for a single file
+// ---------------------------------------------------------------------------
+DirstatFileStats dirstat_file_stats(const char *filepath) {
+    return get_file_stats_at(AT_FDCWD, filepath, 1, NULL, NULL);
+}
+
+// Same, for `name` relative to the directory open at `dirfd`, classifying
+// its lines as `lang` and hashing its head into `head` if not NULL.
+DirstatFileStats get_file_stats_at(int dirfd, const char *name, int detectBinary, const Language *lang,
+                                   HeadHash *head) {
+    return get_file_sample_stats(dirfd, name, LLONG_MAX, 1, detectBinary, lang, head);
+}
+
+// Count at most `limit` bytes of the file, read as `chunks` equal pieces
+// spread evenly from its start to its end (--estimate: a long file's head
+// is not representative of the rest). `limit` bytes are expected to be
+// available; a file that shrank is simply counted short.
+DirstatFileStats get_file_sample_stats(int dirfd, const char *name, long long limit, int chunks, int detectBinary,
+                                       const Language *lang, HeadHash *head) {
+    DirstatFileStats s = {0};
+    pthread_once(&countNewlinesOnce, select_newline_kernel);
+    unsigned long long t = profile_start();
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    profile_phase(PHASE_OPEN, t, 1);
+    if (fd < 0)
+        return s;
+    if (chunks <= 1) {
+        count_fd(fd, &s, limit, detectBinary, lang, head);
+    } else {
+        struct stat st;
+        long long chunk = limit / chunks;
+        if (fstat(fd, &st) != 0 || st.st_size <= limit) {
+            count_fd(fd, &s, limit, detectBinary, lang, head);
+        } else {
+            for (int i = 0; i < chunks; i++) {
+                off_t offset = (off_t) ((st.st_size - chunk) / (chunks - 1) * i);
+                if (lseek(fd, offset, SEEK_SET) < 0)
+                    break;
+                long long before = s.bytes;
+                count_fd(fd, &s, before + chunk, detectBinary, lang, i == 0 ? head : NULL);
+                if (s.bytes == before || s.binaryFiles)
+                    break;
+            }
+        }
+    }
+    t = profile_start();
+    close(fd);
+    profile_phase(PHASE_CLOSE, t, 1);
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// --io=mmap variant of get_file_stats_at. Files of at least MMAP_MIN_SIZE
+// (going by the size the caller already got from statx) are mapped with
+// MAP_POPULATE and counted in place; everything else is read() after a
+// POSIX_FADV_SEQUENTIAL hint. With detectBinary the first BINARY_PROBE_SIZE
+// bytes are read before mapping, so binary files are never mapped.
+// Touching the pages of a mapped file past its end raises SIGBUS, and the
+// library leaves signal handling to the program: the file is mapped with
+// every page faulted in up front, and if it shrank by then it is counted
+// with read() instead. A file truncated in the moment between that check
+// and the count still raises SIGBUS.
+// ---------------------------------------------------------------------------
+DirstatFileStats get_file_stats_mmap(int dirfd, const char *name, off_t sizeHint, int detectBinary,
+                                     const Language *lang, HeadHash *head) {
+    DirstatFileStats s = {0};
+    pthread_once(&countNewlinesOnce, select_newline_kernel);
+    unsigned long long t = profile_start();
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    t = profile_phase(PHASE_OPEN, t, 1);
+    if (fd < 0)
+        return s;
+    struct stat st;
+    // Re-check the size on the open file so the mapping never extends past EOF.
+    if (sizeHint >= MMAP_MIN_SIZE && fstat(fd, &st) == 0 && st.st_size >= MMAP_MIN_SIZE) {
+        t = profile_phase(PHASE_STAT, t, 1);
+        if (detectBinary) {
+            _Alignas(64) unsigned char probe[BINARY_PROBE_SIZE];
+            ssize_t n = pread(fd, probe, sizeof(probe), 0);
+            t = profile_phase(PHASE_READ, t, 1);
+            if (n > 0 && binary_block(probe, (size_t) n)) {
+                if (threadProfile)
+                    threadProfile->bytesRead += (unsigned long long) n;
+                if (head)
+                    head_hash(head, probe, (size_t) n);
+                s = binary_file_stats(st.st_size);
+                profile_phase(PHASE_COUNT, t, 1);
+                t = profile_start();
+                close(fd);
+                profile_phase(PHASE_CLOSE, t, 1);
+                return s;
+            }
+        }
+        void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        struct stat now;
+        if (map != MAP_FAILED && (fstat(fd, &now) != 0 || now.st_size < st.st_size)) {
+            // Shrank since the first fstat: count it with read() below.
+            munmap(map, (size_t) st.st_size);
+            map = MAP_FAILED;
+        }
+        t = profile_phase(PHASE_READ, t, 2);
+        if (map != MAP_FAILED) {
+            if (head)
+                head_hash(head, map, (size_t) st.st_size);
+            s.bytes = s.chars = st.st_size;
+            if (lang) {
+                LineState ls = {0};
+                lang->classify(&ls, map, (size_t) st.st_size, &s);
+            } else {
+                s.lines = (long long) count_newlines(map, (size_t) st.st_size);
+            }
+            t = profile_phase(PHASE_COUNT, t, 1);
+            munmap(map, (size_t) st.st_size);
+            t = profile_phase(PHASE_READ, t, 1);
+            close(fd);
+            profile_phase(PHASE_CLOSE, t, 1);
+            if (threadProfile)
+                threadProfile->bytesRead += (unsigned long long) st.st_size;
+            return s;
+        }
+    } else if (sizeHint >= MMAP_MIN_SIZE) {
+        t = profile_phase(PHASE_STAT, t, 1);
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    profile_phase(PHASE_READ, t, 1);
+    count_fd(fd, &s, LLONG_MAX, detectBinary, lang, head);
+    t = profile_start();
+    close(fd);
+    profile_phase(PHASE_CLOSE, t, 1);
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// --io=uring backend.
+// Each walker owns a ring with URING_DEPTH file slots. A queued file runs
+// through openat -> read ... read -> close as separate requests; every
+// completion immediately submits the next step for that slot, so up to
+// URING_DEPTH files are in flight at once and the walker only blocks when all
+// slots are busy. Read blocks go through the same newline kernels.
+// ---------------------------------------------------------------------------
+typedef enum {
+    SLOT_OPEN,
+    SLOT_READ,
+    SLOT_CLOSE
+} UringSlotState;
+
+typedef struct {
+    UringSlotState state;
+    char *name;        // owned until the openat completes
+    DirHandle *dir;    // referenced until the openat completes
+    DirNode *node;     // the directory's totals (directory hook), referenced until done
+    const char *ext;   // interned in the walker's ExtTable
+    struct stat st;    // for the cache record (only valid if haveStat)
+    int haveStat;
+    int fd;
+    unsigned long long offset;
+    DirstatFileStats stats;
+    const Language *lang;   // classify the lines as this, if not NULL
+    LineState lines;
+    HeadHash head;          // --duplicates: taken from the first block
+    unsigned long long started;   // --profile: queue time
+    char *path;        // full path, for --profile, the file hook and --duplicates
+    ScanState *scan;   // the walker state the file is counted in
+} UringSlot;
+
+struct IoRing {
+    int ringFd;
+    void *sqPtr, *cqPtr;
+    size_t sqSize, cqSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned unsubmitted;
+    int inFlight;
+    int numFree;
+    int freeSlots[URING_DEPTH];
+    UringSlot slots[URING_DEPTH];
+    unsigned char *buffers;   // URING_DEPTH blocks of URING_BLOCK_SIZE
+};
+
+static void add_file_stats(ScanState *scan, DirNode *node, const char *path, const char *ext, DirstatFileStats fstats) {
+    if (node) {
+        atomic_fetch_add_explicit(&node->files, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&node->bytes, fstats.bytes, memory_order_relaxed);
+        atomic_fetch_add_explicit(&node->lines, fstats.lines, memory_order_relaxed);
+        atomic_fetch_add_explicit(&node->chars, fstats.chars, memory_order_relaxed);
+    }
+    scan->projStats.stats.bytes += fstats.bytes;
+    scan->projStats.stats.lines += fstats.lines;
+    scan->projStats.stats.chars += fstats.chars;
+    scan->projStats.stats.binaryFiles += fstats.binaryFiles;
+    scan->projStats.stats.binaryBytes += fstats.binaryBytes;
+    scan->projStats.stats.codeLines += fstats.codeLines;
+    scan->projStats.stats.commentLines += fstats.commentLines;
+    scan->projStats.stats.blankLines += fstats.blankLines;
+    update_extension_counts(&scan->exts, ext, fstats);
+    if (scan->ds->hooks.file)
+        scan->ds->hooks.file(scan->ds->hooks.user, path, ext, fstats);
+}
+
+static IoRing *uring_create(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int) syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+    if (fd < 0)
+        return NULL;
+    IoRing *r = calloc(1, sizeof(IoRing));
+    if (!r) {
+        perror("calloc");
+        exit(1);
+    }
+    r->ringFd = fd;
+    r->sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cqSize > r->sqSize)
+            r->sqSize = r->cqSize;
+        r->cqSize = r->sqSize;
+    }
+    r->sqPtr = mmap(NULL, r->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sqPtr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cqPtr = r->sqPtr;
+    } else {
+        r->cqPtr = mmap(NULL, r->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cqPtr == MAP_FAILED)
+            goto fail_sq;
+    }
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail_cq;
+    if (posix_memalign((void **) &r->buffers, 4096, (size_t) URING_DEPTH * URING_BLOCK_SIZE) != 0) {
+        perror("posix_memalign");
+        exit(1);
+    }
+
+    char *sq = r->sqPtr, *cq = r->cqPtr;
+    r->sqHead = (unsigned *)(sq + p.sq_off.head);
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)(sq + p.sq_off.array);
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    for (int i = 0; i < URING_DEPTH; i++)
+        r->freeSlots[i] = URING_DEPTH - 1 - i;
+    r->numFree = URING_DEPTH;
+    pthread_once(&countNewlinesOnce, select_newline_kernel);
+    return r;
+
+fail_cq:
+    if (r->cqPtr != r->sqPtr)
+        munmap(r->cqPtr, r->cqSize);
+fail_sq:
+    munmap(r->sqPtr, r->sqSize);
+fail:
+    close(fd);
+    free(r);
+    return NULL;
+}
+
+static void uring_destroy(IoRing *r) {
+    munmap(r->sqes, r->sqesSize);
+    if (r->cqPtr != r->sqPtr)
+        munmap(r->cqPtr, r->cqSize);
+    munmap(r->sqPtr, r->sqSize);
+    close(r->ringFd);
+    free(r->buffers);
+    free(r);
+}
+
+// Queue one request for `slot`. Submitted on the next uring_reap.
+static void uring_push(IoRing *r, int opcode, int fd, const void *addr, unsigned len,
+                       unsigned long long off, int slot) {
+    unsigned tail = *r->sqTail;
+    unsigned idx = tail & *r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char) opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t) addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = (unsigned long long) slot;
+    if (opcode == IORING_OP_OPENAT)
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    r->sqArray[idx] = idx;
+    __atomic_store_n(r->sqTail, tail + 1, __ATOMIC_RELEASE);
+    r->unsubmitted++;
+}
+
+static void uring_complete(IoRing *r, int slot, int res) {
+    UringSlot *s = &r->slots[slot];
+    ScanState *scan = s->scan;
+    unsigned char *buf = r->buffers + (size_t) slot * URING_BLOCK_SIZE;
+    // Only the binary probe is read first: a binary file needs no more.
+    unsigned first = scan->ds->opts.binaryDetect ? BINARY_PROBE_SIZE : URING_BLOCK_SIZE;
+    if (threadProfile)
+        threadProfile->ringRequests++;
+    switch (s->state) {
+        case SLOT_OPEN:
+            scan_check_fds(scan, s->path ? s->path : s->name, -res);
+            free(s->name);
+            s->name = NULL;
+            if (s->dir)
+                dir_handle_release(s->dir);
+            s->dir = NULL;
+            if (res < 0)
+                break;  // unreadable file counts as empty, like dirstat_file_stats
+            s->fd = res;
+            s->state = SLOT_READ;
+            uring_push(r, IORING_OP_READ, s->fd, buf, first, 0, slot);
+            return;
+        case SLOT_READ:
+            if (res == -EINTR || res == -EAGAIN) {
+                uring_push(r, IORING_OP_READ, s->fd, buf, s->offset == 0 ? first : URING_BLOCK_SIZE, s->offset,
+                           slot);
+                return;
+            }
+            if (res > 0 && s->offset == 0 && scan->ds->opts.duplicates)
+                head_hash(&s->head, buf, (size_t) res);
+            if (res > 0 && s->offset == 0 && scan->ds->opts.binaryDetect && binary_block(buf, (size_t) res)) {
+                struct stat st;
+                s->stats = binary_file_stats(fstat(s->fd, &st) == 0 ? st.st_size : res);
+                if (threadProfile)
+                    threadProfile->bytesRead += (unsigned long long) res;
+                res = 0;   // nothing more to read
+            }
+            if (res > 0) {
+                unsigned long long t = profile_start();
+                s->stats.bytes += res;
+                s->stats.chars += res;
+                if (s->lang)
+                    s->lang->classify(&s->lines, buf, (size_t) res, &s->stats);
+                else
+                    s->stats.lines += (long long) count_newlines(buf, (size_t) res);
+                profile_phase(PHASE_COUNT, t, 1);
+                if (threadProfile)
+                    threadProfile->bytesRead += (unsigned long long) res;
+                s->offset += (unsigned long long) res;
+                uring_push(r, IORING_OP_READ, s->fd, buf, URING_BLOCK_SIZE, s->offset, slot);
+                return;
+            }
+            s->state = SLOT_CLOSE;
+            uring_push(r, IORING_OP_CLOSE, s->fd, NULL, 0, 0, slot);
+            return;
+        case SLOT_CLOSE:
+            break;
+    }
+    add_file_stats(scan, s->node, s->path, s->ext, s->stats);
+    if (s->node) {
+        dir_node_release(s->node);
+        s->node = NULL;
+    }
+    if (scan->recordCache && s->haveStat)
+        cache_record_file(scan, &s->st, s->ext, s->stats, &s->head);
+    if (s->haveStat)
+        dup_record_file(scan, &s->st, s->path, s->ext, &s->head);
+    if (s->path) {
+        if (scan->profile)
+            profile_file(scan->profile, s->path, s->stats.bytes, profile_now() - s->started);
+        free(s->path);
+        s->path = NULL;
+    }
+    r->freeSlots[r->numFree++] = slot;
+    r->inFlight--;
+}
+
+// Submit everything queued and process completions, waiting for at least
+// `waitFor` of them.
+static void uring_reap(IoRing *r, unsigned waitFor) {
+    for (;;) {
+        unsigned long long t = profile_start();
+        long ret = syscall(__NR_io_uring_enter, r->ringFd, r->unsubmitted, waitFor,
+                           waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        profile_phase(PHASE_URING, t, 1);
+        if (ret >= 0) {
+            r->unsubmitted -= (unsigned) ret;
+            break;
+        }
+        if (errno != EINTR) {
+            perror("io_uring_enter");
+            exit(1);
+        }
+    }
+    unsigned head = *r->cqHead;
+    unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+        head++;
+        uring_complete(r, (int) cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+static void uring_queue_file(IoRing *r, ScanState *scan, DirHandle *dir, const char *name,
+                             const struct stat *st, const char *ext, const Language *lang) {
+    // Intern before reaping: completions may not touch `name` (it can live in
+    // the caller's buffers) but they may grow the ExtTable.
+    const char *interned = ext_table_get(&scan->exts, ext)->ext;
+    while (r->numFree == 0)
+        uring_reap(r, 1);
+    int slot = r->freeSlots[--r->numFree];
+    UringSlot *s = &r->slots[slot];
+    s->state = SLOT_OPEN;
+    s->name = strdup(name);
+    if (!s->name) {
+        perror("strdup");
+        exit(1);
+    }
+    s->dir = dir;
+    if (dir)
+        atomic_fetch_add(&dir->refs, 1);
+    s->node = dir ? dir->node : NULL;
+    if (s->node)
+        atomic_fetch_add(&s->node->refs, 1);
+    s->ext = interned;
+    s->scan = scan;
+    s->haveStat = (st != NULL);
+    if (st)
+        s->st = *st;
+    s->fd = -1;
+    s->offset = 0;
+    s->stats = (DirstatFileStats){0};
+    s->lang = lang;
+    s->lines = (LineState){0};
+    s->head = (HeadHash){0};
+    if (scan->profile || scan->ds->hooks.file || scan->ds->opts.duplicates) {
+        s->started = profile_now();
+        s->path = strdup(scan->path);
+        if (!s->path) {
+            perror("strdup");
+            exit(1);
+        }
+    }
+    r->inFlight++;
+    uring_push(r, IORING_OP_OPENAT, dir ? dir->fd : AT_FDCWD, s->name, 0, 0, slot);
+}
+
+// Wait until every queued file has been counted.
+static void uring_drain(IoRing *r) {
+    while (r->inFlight > 0)
+        uring_reap(r, 1);
+}
+
+// ---------------------------------------------------------------------------
+// Set up / tear down the per-walker I/O state for the selected backend.
+// Falls back to --io=sync if io_uring is unavailable.
+// ---------------------------------------------------------------------------
+static void scan_io_begin(ScanState *scan) {
+    threadProfile = scan->profile;
+    if (scan->ds->opts.ioBackend != DIRSTAT_IO_URING)
+        return;
+    scan->ring = uring_create();
+    if (!scan->ring) {
+        static atomic_int warned;
+        if (atomic_exchange(&warned, 1) == 0)
+            fprintf(stderr, "io_uring unavailable (%s), falling back to --io=sync\n", strerror(errno));
+    }
+}
+
+static void scan_io_end(ScanState *scan) {
+    if (scan->ring) {
+        uring_drain(scan->ring);
+        uring_destroy(scan->ring);
+        scan->ring = NULL;
+    }
+    threadProfile = NULL;
+}
+
+// Fail the scan if `err` says an entry could not be opened for lack of fds:
+// that is not the entry's fault, and skipping it would silently leave the
+// totals short. Only the first is reported.
+static void scan_check_fds(ScanState *scan, const char *path, int err) {
+    if ((err == EMFILE || err == ENFILE) && !atomic_exchange(&scan->ds->outOfFds, 1))
+        fprintf(stderr, "%s: %s\n", path, strerror(err));
+}
+
+// Count the regular file `name` in `dir` (NULL: relative to the cwd), from
+// the cache when it is unchanged and otherwise with the selected backend.
+// `st` is only available when the cache or backend needed a statx.
+// With io_uring the totals are added when the file completes, not on return.
+static void scan_regular_file(ScanState *scan, DirHandle *dir, const char *name, const struct stat *st) {
+    int dirfd = dir ? dir->fd : AT_FDCWD;
+    const char *filename = strrchr(name, '/');
+    if (filename)
+        filename++; // Skip '/'
+    else
+        filename = name;
+    const char *ext = dirstat_file_extension(filename);
+    DirstatFileStats fstats;
+    unsigned long long started = 0;
+    const CacheFileEntry *cached = st ? cache_lookup_file(scan->cache, st, ext) : NULL;
+    const DirstatOptions *opts = &scan->ds->opts;
+    const Language *lang = opts->classify ? extension_language(ext) : NULL;
+    // --duplicates: files cached before their head was hashed are read once more.
+    HeadHash head = {0};
+    HeadHash *wantHead = opts->duplicates ? &head : NULL;
+    if (cached && opts->duplicates && !(cached->flags & CACHE_FILE_HEAD_HASH))
+        cached = NULL;
+    errno = 0;
+    if (st && binary_extension(scan->ds, ext)) {
+        fstats = binary_file_stats(st->st_size);
+        if (opts->estimateMode)
+            ext_table_get(&scan->exts, ext)->sample.knownBytes += st->st_size;
+    } else if (opts->estimateMode && st) {
+        // Bytes and characters are exact from metadata; lines are estimated
+        // at the end from the sampled files' lines per byte.
+        fstats = (DirstatFileStats){.bytes = st->st_size, .chars = st->st_size};
+        ExtSlot *slot = ext_table_slot(&scan->exts, ext);
+        DirstatExtCount *e = &slot->entry;
+        if (st->st_size > ESTIMATE_SAMPLE_SIZE) {
+            // Few files hold most of the bytes, so every large file is
+            // visited; only ESTIMATE_CHUNKS pieces of it are read.
+            started = profile_start();
+            DirstatFileStats sample = get_file_sample_stats(dirfd, name, ESTIMATE_SAMPLE_SIZE, ESTIMATE_CHUNKS,
+                                                            opts->binaryDetect, NULL, wantHead);
+            if (sample.binaryFiles)
+                fstats = binary_file_stats(st->st_size);
+            else if (sample.bytes > 0)
+                fstats.lines = (long long) ((double) sample.lines * (double) st->st_size / (double) sample.bytes);
+            e->sample.knownBytes += st->st_size;
+        } else {
+            unsigned long long hash = estimate_hash(scan->path + scan->rootLen);
+            int sampled = estimate_sampled(opts->estimateRate, hash);
+            if (sampled || estimate_reserve_wants(slot->reserve, hash)) {
+                // Sampled binary files stay in the sample with no lines, so
+                // the ratio also covers the binary files that were not read.
+                // Only files sampled at the rate are counted as binary:
+                // whether a reserve file is read depends on what its walker
+                // saw before.
+                started = profile_start();
+                DirstatFileStats sample = get_file_sample_stats(dirfd, name, ESTIMATE_SAMPLE_SIZE, 1,
+                                                                opts->binaryDetect, NULL, wantHead);
+                if (sample.binaryFiles) {
+                    if (sampled)
+                        fstats = binary_file_stats(st->st_size);
+                    sample = (DirstatFileStats){.bytes = st->st_size};
+                }
+                if (sampled)
+                    estimate_add_sample(&e->sample, sample);
+                else
+                    estimate_reserve_add(&slot->reserve, hash, sample.bytes, sample.lines);
+            }
+        }
+    } else if (cached) {
+        fstats.bytes = cached->bytes;
+        fstats.lines = cached->lines;
+        int binary = (cached->flags & CACHE_FILE_BINARY) != 0;
+        fstats.chars = binary ? 0 : cached->bytes;
+        fstats.binaryFiles = binary ? 1 : 0;
+        fstats.binaryBytes = binary ? cached->bytes : 0;
+        fstats.codeLines = cached->codeLines;
+        fstats.commentLines = cached->commentLines;
+        fstats.blankLines = lang ? cached->lines - cached->codeLines - cached->commentLines : 0;
+        // Kept for the next cache even when this scan does not need it
+        head.hash = cached->headHash;
+        head.done = (cached->flags & CACHE_FILE_HEAD_HASH) != 0;
+    } else if (scan->ring) {
+        uring_queue_file(scan->ring, scan, dir, name, st, ext, lang);
+        return;
+    } else if (opts->ioBackend == DIRSTAT_IO_MMAP) {
+        started = profile_start();
+        fstats = get_file_stats_mmap(dirfd, name, st ? st->st_size : MMAP_MIN_SIZE, opts->binaryDetect, lang,
+                                     wantHead);
+    } else {
+        started = profile_start();
+        fstats = get_file_stats_at(dirfd, name, opts->binaryDetect, lang, wantHead);
+    }
+    scan_check_fds(scan, scan->path, errno);
+    if (scan->profile)
+        profile_file(scan->profile, scan->path, fstats.bytes, started ? profile_now() - started : 0);
+    add_file_stats(scan, dir ? dir->node : NULL, scan->path, ext, fstats);
+    if (scan->recordCache && st)
+        cache_record_file(scan, st, ext, fstats, &head);
+    if (st)
+        dup_record_file(scan, st, scan->path, ext, &head);
+    if (scan->watch && dir)
+        watch_record_file(scan, dir, name, ext, fstats, st);
+}
+
+// ---------------------------------------------------------------------------
+// Extension of a filename ("c" for "main.c"), or "no_ext" when there is none.
+// Dotfiles such as ".bashrc" have no extension.
+// ---------------------------------------------------------------------------
+const char *dirstat_file_extension(const char *filename) {
+    const char *dot = strrchr(filename, '.');
+    if (dot && dot != filename)
+        return dot + 1;
+    return "no_ext";
+}
+
+// FNV-1a; never returns 0 since that marks an empty slot.
+static unsigned long long hash_extension(const char *ext) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *) ext; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+// Copy `str` into the chunk list; NULL if a new chunk cannot be allocated.
+static const char *intern_string_try(StrChunk **strings, const char *str) {
+    size_t len = strlen(str) + 1;
+    StrChunk *chunk = *strings;
+    if (!chunk || chunk->size - chunk->used < len) {
+        size_t size = (len > 4096) ? len : 4096;
+        chunk = malloc(sizeof(StrChunk) + size);
+        if (!chunk)
+            return NULL;
+        chunk->next = *strings;
+        chunk->used = 0;
+        chunk->size = size;
+        *strings = chunk;
+    }
+    char *copy = chunk->data + chunk->used;
+    memcpy(copy, str, len);
+    chunk->used += len;
+    return copy;
+}
+
+static const char *intern_string(StrChunk **strings, const char *str) {
+    const char *copy = intern_string_try(strings, str);
+    if (!copy) {
+        perror("malloc");
+        exit(1);
+    }
+    return copy;
+}
+
+static void ext_table_grow(ExtTable *table) {
+    size_t newCapacity = (table->capacity == 0) ? 64 : (table->capacity * 2);
+    ExtSlot *slots = calloc(newCapacity, sizeof(ExtSlot));
+    if (!slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].hash == 0)
+            continue;
+        size_t j = table->slots[i].hash & (newCapacity - 1);
+        while (slots[j].hash != 0)
+            j = (j + 1) & (newCapacity - 1);
+        slots[j] = table->slots[i];
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = newCapacity;
+}
+
+// ---------------------------------------------------------------------------
+// Find the slot for `ext`, inserting an empty one if needed. The returned
+// pointer is only valid until the next insert; entry.ext is stable.
+// ---------------------------------------------------------------------------
+ExtSlot *ext_table_slot(ExtTable *table, const char *ext) {
+    if ((table->used + 1) * 4 > table->capacity * 3)
+        ext_table_grow(table);
+    unsigned long long hash = hash_extension(ext);
+    size_t i = hash & (table->capacity - 1);
+    while (table->slots[i].hash != 0) {
+        if (table->slots[i].hash == hash && strcmp(table->slots[i].entry.ext, ext) == 0)
+            return &table->slots[i];
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->slots[i].hash = hash;
+    memset(&table->slots[i].entry, 0, sizeof(DirstatExtCount));
+    table->slots[i].entry.ext = intern_string(&table->strings, ext);
+    table->slots[i].reserve = NULL;
+    table->used++;
+    return &table->slots[i];
+}
+
+DirstatExtCount *ext_table_get(ExtTable *table, const char *ext) {
+    return &ext_table_slot(table, ext)->entry;
+}
+
+// ---------------------------------------------------------------------------
+// --estimate: files larger than ESTIMATE_SAMPLE_SIZE are all visited and
+// extrapolated from ESTIMATE_CHUNKS pieces spread over the file. For the
+// small files every extension is one stratum. Each file gets a hash of its
+// path relative to the root and is sampled if the hash falls below the
+// rate; an extension with fewer than ESTIMATE_MIN_SAMPLES such files is
+// topped up with the files of lowest hash above the rate. Walkers keep
+// those in a small reserve that is merged like the counts, so the sample
+// is uniform and the same on every run and for any --jobs. The lines are
+// the ratio estimate
+//     lines = bytes * (sampled lines / sampled bytes)
+// with the usual linearized variance of a ratio estimator. Confidence
+// intervals assume the strata are independent and leave out the error of
+// the large files' extrapolation.
+// ---------------------------------------------------------------------------
+unsigned long long estimate_hash(const char *relPath) {
+    unsigned long long h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *) relPath; *p; p++)
+        h = (h ^ *p) * 1099511628211ULL;
+    // FNV-1a leaves the high bits poorly mixed on short paths
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+int estimate_sampled(double rate, unsigned long long hash) {
+    return (double) (hash >> 11) < rate * 9007199254740992.0;   // rate * 2^53
+}
+
+int estimate_reserve_wants(const EstimateReserve *r, unsigned long long hash) {
+    return !r || r->n < ESTIMATE_MIN_SAMPLES || hash < r->items[0].hash;
+}
+
+// Keep the file if its hash is among the ESTIMATE_MIN_SAMPLES lowest seen.
+void estimate_reserve_add(EstimateReserve **rp, unsigned long long hash, long long bytes, long long lines) {
+    EstimateReserve *r = *rp;
+    if (!r) {
+        r = *rp = calloc(1, sizeof(EstimateReserve));
+        if (!r) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    int i;
+    if (r->n < ESTIMATE_MIN_SAMPLES) {
+        for (i = r->n++; i > 0 && r->items[(i - 1) / 2].hash < hash; i = (i - 1) / 2)
+            r->items[i] = r->items[(i - 1) / 2];
+    } else if (hash < r->items[0].hash) {
+        for (i = 0;;) {
+            int child = 2 * i + 1;
+            if (child >= r->n)
+                break;
+            if (child + 1 < r->n && r->items[child + 1].hash > r->items[child].hash)
+                child++;
+            if (r->items[child].hash <= hash)
+                break;
+            r->items[i] = r->items[child];
+            i = child;
+        }
+    } else {
+        return;
+    }
+    r->items[i].hash = hash;
+    r->items[i].bytes = bytes;
+    r->items[i].lines = lines;
+}
+
+void estimate_add_sample(DirstatEstimateSample *s, DirstatFileStats sample) {
+    double b = (double) sample.bytes, l = (double) sample.lines;
+    s->n++;
+    s->bytes += b;
+    s->lines += l;
+    s->bb += b * b;
+    s->ll += l * l;
+    s->lb += l * b;
+}
+
+void estimate_merge(DirstatEstimateSample *dst, const DirstatEstimateSample *src) {
+    dst->n += src->n;
+    dst->bytes += src->bytes;
+    dst->lines += src->lines;
+    dst->bb += src->bb;
+    dst->ll += src->ll;
+    dst->lb += src->lb;
+    dst->knownBytes += src->knownBytes;
+}
+
+static int compare_reserve_item(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *) a, y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+// Top up every extension's sample to ESTIMATE_MIN_SAMPLES files from its
+// reserve, lowest hashes first, and drop the reserves.
+void estimate_settle(ExtTable *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        ExtSlot *slot = &table->slots[i];
+        EstimateReserve *r = slot->reserve;
+        if (slot->hash == 0 || !r)
+            continue;
+        qsort(r->items, r->n, sizeof(r->items[0]), compare_reserve_item);
+        for (int j = 0; j < r->n && slot->entry.sample.n < ESTIMATE_MIN_SAMPLES; j++)
+            estimate_add_sample(&slot->entry.sample,
+                                (DirstatFileStats){.bytes = r->items[j].bytes, .lines = r->items[j].lines});
+        free(r);
+        slot->reserve = NULL;
+    }
+}
+
+// 95% confidence half-width for a variance. Newton's method from above, so
+// the tool does not need libm for this one square root.
+static double ci95(double variance) {
+    if (variance <= 0)
+        return 0;
+    double r = variance > 1 ? variance : 1;
+    for (int i = 0; i < 128; i++) {
+        double next = 0.5 * (r + variance / r);
+        if (next >= r)
+            break;
+        r = next;
+    }
+    return 1.96 * r;
+}
+
+// Fill in the estimated lines and confidence half-width of every extension
+// and the estimated total lines; returns the total's half-width.
+double estimate_finish(DirstatExtCount *entries, int count, DirstatProjectStats *projStats) {
+    double totalVariance = 0;
+    projStats->stats.lines = 0;
+    for (int i = 0; i < count; i++) {
+        DirstatExtCount *e = &entries[i];
+        const DirstatEstimateSample *s = &e->sample;
+        double variance = 0;
+        double total = (double) (e->bytes - s->knownBytes);   // bytes of the small text files
+        if (s->bytes > 0) {
+            double ratio = s->lines / s->bytes;
+            double estimated = ratio * total;
+            e->lines += (long long) (estimated + 0.5);
+            double sampledShare = s->bytes < total ? s->bytes / total : 1.0;
+            if (s->n > 1) {
+                // Residual variance of lines around ratio * bytes
+                double residual = (s->ll - 2 * ratio * s->lb + ratio * ratio * s->bb) / (double) (s->n - 1);
+                variance = total * total * (1.0 - sampledShare) * residual * (double) s->n / (s->bytes * s->bytes);
+            } else if (sampledShare < 1.0) {
+                variance = estimated * estimated;   // one sample: no spread to go by
+            }
+        }
+        if (variance < 0)
+            variance = 0;
+        e->linesCi = ci95(variance);
+        totalVariance += variance;
+        projStats->stats.lines += e->lines;
+    }
+    return ci95(totalVariance);
+}
+
+// ---------------------------------------------------------------------------
+// Count one file with the given extension
+// ---------------------------------------------------------------------------
+void update_extension_counts(ExtTable *table, const char *ext, DirstatFileStats fstats) {
+    DirstatExtCount *e = ext_table_get(table, ext);
+    e->count++;
+    e->bytes += fstats.bytes;
+    e->lines += fstats.lines;
+    e->chars += fstats.chars;
+    e->codeLines += fstats.codeLines;
+    e->commentLines += fstats.commentLines;
+    e->blankLines += fstats.blankLines;
+}
+
+// ---------------------------------------------------------------------------
+// Fold one extension table into another (used to combine per-thread results)
+// ---------------------------------------------------------------------------
+void merge_extension_counts(ExtTable *dst, const ExtTable *src) {
+    for (size_t i = 0; i < src->capacity; i++) {
+        if (src->slots[i].hash == 0)
+            continue;
+        const DirstatExtCount *s = &src->slots[i].entry;
+        ExtSlot *slot = ext_table_slot(dst, s->ext);
+        DirstatExtCount *e = &slot->entry;
+        e->count += s->count;
+        e->bytes += s->bytes;
+        e->lines += s->lines;
+        e->chars += s->chars;
+        e->codeLines += s->codeLines;
+        e->commentLines += s->commentLines;
+        e->blankLines += s->blankLines;
+        estimate_merge(&e->sample, &s->sample);
+        const EstimateReserve *r = src->slots[i].reserve;
+        for (int j = 0; r && j < r->n; j++)
+            estimate_reserve_add(&slot->reserve, r->items[j].hash, r->items[j].bytes, r->items[j].lines);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Copy the table's entries into a newly allocated array for sorting/printing.
+// The ext strings still belong to the table.
+// ---------------------------------------------------------------------------
+DirstatExtCount *ext_table_entries(const ExtTable *table, int *count) {
+    DirstatExtCount *list = malloc((table->used ? table->used : 1) * sizeof(DirstatExtCount));
+    if (!list) {
+        perror("malloc");
+        exit(1);
+    }
+    int n = 0;
+    for (size_t i = 0; i < table->capacity; i++) {
+        // Extensions whose files all went away (--watch) have no row.
+        if (table->slots[i].hash != 0 && table->slots[i].entry.count > 0)
+            list[n++] = table->slots[i].entry;
+    }
+    *count = n;
+    return list;
+}
+
+void ext_table_free(ExtTable *table) {
+    for (size_t i = 0; i < table->capacity; i++)
+        free(table->slots[i].reserve);
+    free(table->slots);
+    while (table->strings) {
+        StrChunk *next = table->strings->next;
+        free(table->strings);
+        table->strings = next;
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+// ---------------------------------------------------------------------------
+// Persistent scan cache.
+// Files are keyed by (st_dev, st_ino) and only trusted when st_size, st_mtim,
+// st_ctim and the extension still match, so unchanged files are never re-read.
+// Directories are keyed the same way and store their entry names; if a
+// directory's mtime is unchanged its entries cannot have changed, and the
+// cached names are walked instead of calling readdir.
+// Like git's racy-index check, entries whose mtime is not older than the
+// start of the scan that wrote them are ignored: they may have changed again
+// within the same timestamp tick.
+// ---------------------------------------------------------------------------
+ScanCache *cache_open(const char *cachePath, int binaryDetect, int classify) {
+    int fd = open(cachePath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    const CacheHeader *h = map;
+    size_t size = (size_t) st.st_size;
+    // Validate every section against the file size before trusting offsets.
+    int ok = memcmp(h->magic, CACHE_MAGIC, 8) == 0 && h->version == CACHE_VERSION &&
+             h->headerSize == sizeof(CacheHeader) && h->binaryDetect == (uint32_t) binaryDetect &&
+             h->classify == (uint32_t) classify &&
+             h->numFiles <= size / sizeof(CacheFileEntry) &&
+             h->numDirs <= size / sizeof(CacheDirEntry) &&
+             h->stringsSize <= size && h->namesSize <= size;
+    size_t filesEnd = 0, dirsEnd = 0, stringsEnd = 0;
+    if (ok) {
+        filesEnd = sizeof(CacheHeader) + h->numFiles * sizeof(CacheFileEntry);
+        dirsEnd = filesEnd + h->numDirs * sizeof(CacheDirEntry);
+        stringsEnd = dirsEnd + h->stringsSize;
+        ok = stringsEnd <= size && stringsEnd + h->namesSize == size &&
+             (h->stringsSize == 0 || ((const char *) map)[stringsEnd - 1] == '\0') &&
+             (h->namesSize == 0 || ((const char *) map)[size - 1] == '\0');
+    }
+    if (!ok) {
+        munmap(map, size);
+        return NULL;
+    }
+    ScanCache *cache = calloc(1, sizeof(ScanCache));
+    if (!cache) {
+        perror("calloc");
+        exit(1);
+    }
+    cache->map = map;
+    cache->mapSize = size;
+    cache->header = h;
+    cache->files = (const CacheFileEntry *)((const char *) map + sizeof(CacheHeader));
+    cache->dirs = (const CacheDirEntry *)((const char *) map + filesEnd);
+    cache->strings = (const char *) map + dirsEnd;
+    cache->names = (const char *) map + stringsEnd;
+    return cache;
+}
+
+void cache_close(ScanCache *cache) {
+    if (!cache)
+        return;
+    munmap(cache->map, cache->mapSize);
+    free(cache);
+}
+
+static int cache_key_cmp(uint64_t devA, uint64_t inoA, uint64_t devB, uint64_t inoB) {
+    if (devA != devB)
+        return devA < devB ? -1 : 1;
+    if (inoA != inoB)
+        return inoA < inoB ? -1 : 1;
+    return 0;
+}
+
+static int cache_time_matches(const ScanCache *cache, int64_t sec, uint32_t nsec, const struct timespec *ts) {
+    return sec == (int64_t) ts->tv_sec && nsec == (uint32_t) ts->tv_nsec && sec < cache->header->scanStartSec;
+}
+
+const CacheFileEntry *cache_lookup_file(const ScanCache *cache, const struct stat *st, const char *ext) {
+    if (!cache)
+        return NULL;
+    size_t lo = 0, hi = cache->header->numFiles;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const CacheFileEntry *e = &cache->files[mid];
+        int c = cache_key_cmp(e->dev, e->ino, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+        if (c == 0) {
+            if (e->size != (int64_t) st->st_size || !cache_time_matches(cache, e->mtimeSec, e->mtimeNsec, &st->st_mtim) ||
+                !cache_time_matches(cache, e->ctimeSec, e->ctimeNsec, &st->st_ctim) ||
+                e->extOffset >= cache->header->stringsSize || strcmp(cache->strings + e->extOffset, ext) != 0)
+                return NULL;
+            return e;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+const CacheDirEntry *cache_lookup_dir(const ScanCache *cache, const struct stat *st) {
+    if (!cache)
+        return NULL;
+    size_t lo = 0, hi = cache->header->numDirs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const CacheDirEntry *e = &cache->dirs[mid];
+        int c = cache_key_cmp(e->dev, e->ino, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+        if (c == 0) {
+            if (!cache_time_matches(cache, e->mtimeSec, e->mtimeNsec, &st->st_mtim) ||
+                e->namesOffset > cache->header->namesSize)
+                return NULL;
+            return e;
+        }
+        if (c < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+void cache_record_file(ScanState *scan, const struct stat *st, const char *ext, DirstatFileStats fstats,
+                       const HeadHash *head) {
+    scan->cacheFiles = grow_array(scan->cacheFiles, &scan->capCacheFiles, scan->numCacheFiles + 1, sizeof(CacheRecord));
+    CacheRecord *r = &scan->cacheFiles[scan->numCacheFiles++];
+    memset(r, 0, sizeof(*r));
+    r->entry.dev = (uint64_t) st->st_dev;
+    r->entry.ino = (uint64_t) st->st_ino;
+    r->entry.size = (int64_t) st->st_size;
+    r->entry.mtimeSec = (int64_t) st->st_mtim.tv_sec;
+    r->entry.mtimeNsec = (uint32_t) st->st_mtim.tv_nsec;
+    r->entry.ctimeSec = (int64_t) st->st_ctim.tv_sec;
+    r->entry.ctimeNsec = (uint32_t) st->st_ctim.tv_nsec;
+    r->entry.bytes = fstats.bytes;
+    r->entry.lines = fstats.lines;
+    r->entry.flags = (fstats.binaryFiles ? CACHE_FILE_BINARY : 0) | (head->done ? CACHE_FILE_HEAD_HASH : 0);
+    r->entry.headHash = head->hash;
+    r->entry.codeLines = fstats.codeLines;
+    r->entry.commentLines = fstats.commentLines;
+    r->ext = ext_table_get(&scan->exts, ext)->ext;
+}
+
+// Record a directory and its `count` entries, given in the names blob format.
+static void cache_record_dir(ScanState *scan, const struct stat *st, const char *names, size_t len, uint32_t count) {
+    scan->cacheDirs = grow_array(scan->cacheDirs, &scan->capCacheDirs, scan->numCacheDirs + 1, sizeof(CacheDirEntry));
+    CacheDirEntry *d = &scan->cacheDirs[scan->numCacheDirs++];
+    memset(d, 0, sizeof(*d));
+    d->dev = (uint64_t) st->st_dev;
+    d->ino = (uint64_t) st->st_ino;
+    d->mtimeSec = (int64_t) st->st_mtim.tv_sec;
+    d->mtimeNsec = (uint32_t) st->st_mtim.tv_nsec;
+    d->namesOffset = scan->cacheNamesLen;
+    d->numNames = count;
+    scan->cacheNames = grow_array(scan->cacheNames, &scan->cacheNamesCap, scan->cacheNamesLen + len, 1);
+    if (len > 0)
+        memcpy(scan->cacheNames + scan->cacheNamesLen, names, len);
+    scan->cacheNamesLen += len;
+}
+
+// ---------------------------------------------------------------------------
+// Move a worker's cache records into `dst` (after the ExtTables were merged).
+// ---------------------------------------------------------------------------
+void cache_merge_records(ScanState *dst, ScanState *src) {
+    dst->cacheFiles = grow_array(dst->cacheFiles, &dst->capCacheFiles, dst->numCacheFiles + src->numCacheFiles, sizeof(CacheRecord));
+    for (size_t i = 0; i < src->numCacheFiles; i++) {
+        CacheRecord *r = &dst->cacheFiles[dst->numCacheFiles++];
+        *r = src->cacheFiles[i];
+        r->ext = ext_table_get(&dst->exts, r->ext)->ext;
+    }
+    dst->cacheDirs = grow_array(dst->cacheDirs, &dst->capCacheDirs, dst->numCacheDirs + src->numCacheDirs, sizeof(CacheDirEntry));
+    for (size_t i = 0; i < src->numCacheDirs; i++) {
+        CacheDirEntry *d = &dst->cacheDirs[dst->numCacheDirs++];
+        *d = src->cacheDirs[i];
+        d->namesOffset += dst->cacheNamesLen;
+    }
+    dst->cacheNames = grow_array(dst->cacheNames, &dst->cacheNamesCap, dst->cacheNamesLen + src->cacheNamesLen, 1);
+    if (src->cacheNamesLen > 0)
+        memcpy(dst->cacheNames + dst->cacheNamesLen, src->cacheNames, src->cacheNamesLen);
+    dst->cacheNamesLen += src->cacheNamesLen;
+    free(src->cacheFiles);
+    free(src->cacheDirs);
+    free(src->cacheNames);
+    src->cacheFiles = NULL;
+    src->cacheDirs = NULL;
+    src->cacheNames = NULL;
+}
+
+static int compare_cache_record(const void *a, const void *b) {
+    const CacheFileEntry *ea = &((const CacheRecord *) a)->entry;
+    const CacheFileEntry *eb = &((const CacheRecord *) b)->entry;
+    return cache_key_cmp(ea->dev, ea->ino, eb->dev, eb->ino);
+}
+
+static int compare_cache_dir(const void *a, const void *b) {
+    const CacheDirEntry *ea = a;
+    const CacheDirEntry *eb = b;
+    return cache_key_cmp(ea->dev, ea->ino, eb->dev, eb->ino);
+}
+
+// Create the missing directories leading up to `path` (private to the user,
+// like the rest of ~/.cache). Returns 0 if they all exist afterwards.
+static int make_parent_dirs(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) {
+        perror("strdup");
+        exit(1);
+    }
+    int ret = 0;
+    for (char *slash = strchr(copy + 1, '/'); slash && ret == 0; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        if (mkdir(copy, 0700) != 0 && errno != EEXIST)
+            ret = -1;
+        *slash = '/';
+    }
+    free(copy);
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// Write the records collected during this scan to `cachePath` (via a
+// temporary file and rename, so readers never see a partial cache).
+// Returns 0 on success, -1 if the cache could not be written.
+// ---------------------------------------------------------------------------
+int cache_write(const char *cachePath, ScanState *scan, time_t scanStart) {
+    qsort(scan->cacheFiles, scan->numCacheFiles, sizeof(CacheRecord), compare_cache_record);
+    qsort(scan->cacheDirs, scan->numCacheDirs, sizeof(CacheDirEntry), compare_cache_dir);
+
+    // Hardlinks and overlapping roots can record an inode twice; keep one.
+    size_t numFiles = 0;
+    for (size_t i = 0; i < scan->numCacheFiles; i++) {
+        if (numFiles > 0 && compare_cache_record(&scan->cacheFiles[numFiles - 1], &scan->cacheFiles[i]) == 0)
+            continue;
+        scan->cacheFiles[numFiles++] = scan->cacheFiles[i];
+    }
+    size_t numDirs = 0;
+    for (size_t i = 0; i < scan->numCacheDirs; i++) {
+        if (numDirs > 0 && compare_cache_dir(&scan->cacheDirs[numDirs - 1], &scan->cacheDirs[i]) == 0)
+            continue;
+        scan->cacheDirs[numDirs++] = scan->cacheDirs[i];
+    }
+
+    // Extension strings, each written once. The offset is kept in the
+    // scratch table's count field.
+    ExtTable offsets = {0};
+    char *strings = NULL;
+    size_t stringsLen = 0, stringsCap = 0;
+    for (size_t i = 0; i < numFiles; i++) {
+        DirstatExtCount *e = ext_table_get(&offsets, scan->cacheFiles[i].ext);
+        if (e->count == 0) {
+            size_t len = strlen(e->ext) + 1;
+            strings = grow_array(strings, &stringsCap, stringsLen + len, 1);
+            memcpy(strings + stringsLen, e->ext, len);
+            e->count = (long) stringsLen + 1;
+            stringsLen += len;
+        }
+        scan->cacheFiles[i].entry.extOffset = (uint32_t)(e->count - 1);
+    }
+    ext_table_free(&offsets);
+
+    size_t pathLen = strlen(cachePath);
+    char *tmpPath = malloc(pathLen + 32);
+    if (!tmpPath) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(tmpPath, pathLen + 32, "%s.tmp.%ld", cachePath, (long) getpid());
+    FILE *fp = fopen(tmpPath, "wb");
+    if (!fp && errno == ENOENT && make_parent_dirs(tmpPath) == 0)
+        fp = fopen(tmpPath, "wb");
+    if (!fp) {
+        free(tmpPath);
+        free(strings);
+        return -1;
+    }
+
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, 8);
+    h.version = CACHE_VERSION;
+    h.headerSize = sizeof(CacheHeader);
+    h.scanStartSec = (int64_t) scanStart;
+    h.numFiles = numFiles;
+    h.numDirs = numDirs;
+    h.stringsSize = stringsLen;
+    h.namesSize = scan->cacheNamesLen;
+    h.binaryDetect = (uint32_t) scan->ds->opts.binaryDetect;
+    h.classify = (uint32_t) scan->ds->opts.classify;
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+    for (size_t i = 0; ok && i < numFiles; i++)
+        ok = fwrite(&scan->cacheFiles[i].entry, sizeof(CacheFileEntry), 1, fp) == 1;
+    if (ok && numDirs > 0)
+        ok = fwrite(scan->cacheDirs, sizeof(CacheDirEntry), numDirs, fp) == numDirs;
+    if (ok && stringsLen > 0)
+        ok = fwrite(strings, 1, stringsLen, fp) == stringsLen;
+    if (ok && scan->cacheNamesLen > 0)
+        ok = fwrite(scan->cacheNames, 1, scan->cacheNamesLen, fp) == scan->cacheNamesLen;
+    if (fclose(fp) != 0)
+        ok = 0;
+    if (ok && rename(tmpPath, cachePath) != 0)
+        ok = 0;
+    if (!ok)
+        unlink(tmpPath);
+    free(tmpPath);
+    free(strings);
+    return ok ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Duplicate content (--duplicates). Every walker records the files it counts
+// with the size its statx already got. After the walk the candidates are
+// narrowed down in stages, each reading less than a naive pass would:
+//   1. files whose size no other file has are dropped, without any I/O;
+//   2. the rest are grouped by the hash of their head, taken while they
+//      were read for their lines or kept in the cache; only files of binary
+//      extensions and files --estimate did not sample are read for it now;
+//   3. files sharing a head hash are hashed in full, and files with the
+//      same size and full hash are duplicates.
+// The reads of stages 2 and 3 are spread over opts.jobs threads. Unlike the
+// rest of the scan, running out of memory here only gives up on the
+// duplicates: dirstat_duplicates then reports -1 groups.
+// ---------------------------------------------------------------------------
+
+// Make room for `needed` file records; 0 if out of memory.
+static int dup_reserve(ScanState *scan, size_t needed) {
+    if (needed <= scan->capDupFiles)
+        return 1;
+    size_t cap = scan->capDupFiles ? scan->capDupFiles * 2 : 256;
+    if (cap < needed)
+        cap = needed;
+    DupFile *files = realloc(scan->dupFiles, cap * sizeof(DupFile));
+    if (!files)
+        return 0;
+    scan->dupFiles = files;
+    scan->capDupFiles = cap;
+    return 1;
+}
+
+// Drop the records gathered so far; the paths are freed with the scan.
+static void dup_give_up(ScanState *scan) {
+    scan->dupFailed = 1;
+    free(scan->dupFiles);
+    scan->dupFiles = NULL;
+    scan->numDupFiles = scan->capDupFiles = 0;
+}
+
+void dup_record_file(ScanState *scan, const struct stat *st, const char *path, const char *ext,
+                     const HeadHash *head) {
+    if (!scan->ds->opts.duplicates || st->st_size <= 0 || scan->dupFailed)
+        return;
+    const char *copy = dup_reserve(scan, scan->numDupFiles + 1) ? intern_string_try(&scan->dupPaths, path) : NULL;
+    if (!copy) {
+        dup_give_up(scan);
+        return;
+    }
+    DupFile *f = &scan->dupFiles[scan->numDupFiles++];
+    f->dev = (uint64_t) st->st_dev;
+    f->ino = (uint64_t) st->st_ino;
+    f->size = (long long) st->st_size;
+    f->path = copy;
+    f->ext = ext_table_get(&scan->exts, ext)->ext;
+    f->fullHash = 0;
+    f->head = *head;
+}
+
+// Move a worker's file records into `dst` (after the ExtTables were merged).
+// The paths stay where they are; their chunks change owner.
+void dup_merge(ScanState *dst, ScanState *src) {
+    if (!dst->dupFailed && (src->dupFailed || !dup_reserve(dst, dst->numDupFiles + src->numDupFiles)))
+        dup_give_up(dst);
+    for (size_t i = 0; !dst->dupFailed && i < src->numDupFiles; i++) {
+        DupFile *f = &dst->dupFiles[dst->numDupFiles++];
+        *f = src->dupFiles[i];
+        f->ext = ext_table_get(&dst->exts, f->ext)->ext;
+    }
+    StrChunk **tail = &dst->dupPaths;
+    while (*tail)
+        tail = &(*tail)->next;
+    *tail = src->dupPaths;
+    free(src->dupFiles);
+    src->dupFiles = NULL;
+    src->dupPaths = NULL;
+    src->numDupFiles = src->capDupFiles = 0;
+}
+
+// Hash the head or, with `full`, all of `f` by reading it again. Returns -1
+// if it cannot be read or is shorter than the walk saw.
+static int dup_hash_file(DupFile *f, int full) {
+    _Alignas(64) unsigned char buf[READ_BLOCK_SIZE];
+    int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    long long limit = full || f->size < DUP_HEAD_SIZE ? f->size : DUP_HEAD_SIZE;
+    long long got = 0;
+    Hash64 h;
+    hash64_init(&h);
+    while (got < limit) {
+        size_t want = limit - got < (long long) sizeof(buf) ? (size_t) (limit - got) : sizeof(buf);
+        ssize_t n = read(fd, buf, want);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        hash64_update(&h, buf, (size_t) n);
+        got += n;
+    }
+    close(fd);
+    if (got < limit)
+        return -1;
+    if (full) {
+        f->fullHash = hash64_final(&h);
+    } else {
+        f->head.hash = (uint32_t) hash64_final(&h);
+        f->head.done = 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    DupFile **files;
+    size_t numFiles;
+    int full;
+    atomic_size_t next;
+} DupHashBatch;
+
+// Files that cannot be hashed lose their size, which takes them out of the
+// later stages.
+static void *dup_hash_worker(void *arg) {
+    DupHashBatch *b = arg;
+    for (size_t i; (i = atomic_fetch_add(&b->next, 1)) < b->numFiles;) {
+        if (dup_hash_file(b->files[i], b->full) < 0)
+            b->files[i]->size = -1;
+    }
+    return NULL;
+}
+
+static void dup_hash_files(DupFile **files, size_t numFiles, int full, int jobs) {
+    DupHashBatch b = {files, numFiles, full, 0};
+    if (numFiles == 0)
+        return;
+    if ((size_t) jobs > numFiles)
+        jobs = (int) numFiles;
+    // Without memory for the threads the files are hashed here.
+    pthread_t *threads = jobs > 1 ? calloc(jobs, sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (; threads && started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, dup_hash_worker, &b) != 0)
+            break;
+    }
+    dup_hash_worker(&b);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+static int compare_dup_size(const void *a, const void *b) {
+    const DupFile *fa = a, *fb = b;
+    return fa->size < fb->size ? -1 : fa->size > fb->size;
+}
+
+static int compare_dup_inode(const void *a, const void *b) {
+    const DupFile *fa = a, *fb = b;
+    if (fa->size != fb->size)
+        return fa->size < fb->size ? -1 : 1;
+    return cache_key_cmp(fa->dev, fa->ino, fb->dev, fb->ino);
+}
+
+static int compare_dup_head(const void *a, const void *b) {
+    const DupFile *fa = a, *fb = b;
+    if (fa->size != fb->size)
+        return fa->size < fb->size ? -1 : 1;
+    if (fa->head.hash != fb->head.hash)
+        return fa->head.hash < fb->head.hash ? -1 : 1;
+    return 0;
+}
+
+static int compare_dup_content(const void *a, const void *b) {
+    const DupFile *fa = a, *fb = b;
+    if (fa->size != fb->size)
+        return fa->size < fb->size ? -1 : 1;
+    return fa->fullHash < fb->fullHash ? -1 : fa->fullHash > fb->fullHash;
+}
+
+// Same content first, then by path
+static int compare_dup_full(const void *a, const void *b) {
+    int c = compare_dup_content(a, b);
+    return c ? c : strcmp(((const DupFile *) a)->path, ((const DupFile *) b)->path);
+}
+
+static long long dup_wasted(const DirstatDupGroup *g) {
+    return g->size * (g->count - 1);
+}
+
+static int compare_dup_group(const void *a, const void *b) {
+    const DirstatDupGroup *ga = a, *gb = b;
+    if (dup_wasted(ga) != dup_wasted(gb))
+        return dup_wasted(ga) < dup_wasted(gb) ? 1 : -1;
+    return strcmp(ga->paths[0], gb->paths[0]);
+}
+
+// Keep the runs of files that `compare` finds equal, with a size and at
+// least two files; returns how many files are left.
+static size_t dup_keep_runs(DupFile *files, size_t n, int (*compare)(const void *, const void *)) {
+    size_t kept = 0;
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && compare(&files[i], &files[j]) == 0; j++)
+            ;
+        if (j - i < 2 || files[i].size <= 0)
+            continue;
+        memmove(&files[kept], &files[i], (j - i) * sizeof(DupFile));
+        kept += j - i;
+    }
+    return kept;
+}
+
+// Find the groups of identical files among the records and fill in the
+// Dirstat's groups and the copies' share of every extension. Out of memory
+// leaves no groups and numDupGroups -1.
+void dup_find(Dirstat *ds) {
+    ScanState *scan = &ds->scan;
+    DupFile *files = scan->dupFiles;
+    size_t n = scan->numDupFiles;
+    if (scan->dupFailed) {
+        ds->numDupGroups = -1;
+        return;
+    }
+    if (n < 2)
+        return;
+
+    // Links to one file (--count-hardlinks) are not copies of it. Files of a
+    // --git --estimate scan have no inode and are taken as they are.
+    qsort(files, n, sizeof(DupFile), compare_dup_inode);
+    size_t m = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (m > 0 && files[i].ino != 0 && compare_dup_inode(&files[m - 1], &files[i]) == 0)
+            continue;
+        files[m++] = files[i];
+    }
+    n = dup_keep_runs(files, m, compare_dup_size);
+
+    // Heads of the files that were not read during the walk
+    DupFile **todo = malloc((n ? n : 1) * sizeof(DupFile *));
+    if (!todo) {
+        dup_give_up(scan);
+        ds->numDupGroups = -1;
+        return;
+    }
+    size_t numTodo = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!files[i].head.done)
+            todo[numTodo++] = &files[i];
+    }
+    dup_hash_files(todo, numTodo, 0, ds->opts.jobs);
+    qsort(files, n, sizeof(DupFile), compare_dup_head);
+    n = dup_keep_runs(files, n, compare_dup_head);
+
+    for (size_t i = 0; i < n; i++)
+        todo[i] = &files[i];
+    dup_hash_files(todo, n, 1, ds->opts.jobs);
+    free(todo);
+    qsort(files, n, sizeof(DupFile), compare_dup_full);
+    n = dup_keep_runs(files, n, compare_dup_content);
+
+    // The runs left are the groups, their files sorted by path.
+    int numGroups = 0;
+    for (size_t i = 0; i < n; i++)
+        numGroups += (i == 0 || compare_dup_content(&files[i - 1], &files[i]) != 0);
+    ds->dupGroups = calloc(numGroups ? numGroups : 1, sizeof(DirstatDupGroup));
+    ds->dupGroupPaths = malloc((n ? n : 1) * sizeof(const char *));
+    if (!ds->dupGroups || !ds->dupGroupPaths) {
+        free(ds->dupGroups);
+        free(ds->dupGroupPaths);
+        ds->dupGroups = NULL;
+        ds->dupGroupPaths = NULL;
+        dup_give_up(scan);
+        ds->numDupGroups = -1;
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (i == 0 || compare_dup_content(&files[i - 1], &files[i]) != 0) {
+            DirstatDupGroup *g = &ds->dupGroups[ds->numDupGroups++];
+            g->size = files[i].size;
+            g->paths = &ds->dupGroupPaths[i];
+        } else {
+            DirstatExtCount *e = ext_table_get(&scan->exts, files[i].ext);
+            e->dupFiles++;
+            e->dupBytes += files[i].size;
+        }
+        ds->dupGroupPaths[i] = files[i].path;
+        ds->dupGroups[ds->numDupGroups - 1].count++;
+    }
+    qsort(ds->dupGroups, (size_t) ds->numDupGroups, sizeof(DirstatDupGroup), compare_dup_group);
+    free(scan->dupFiles);
+    scan->dupFiles = NULL;
+    scan->numDupFiles = scan->capDupFiles = 0;
+}
+
+void dup_free(Dirstat *ds) {
+    ScanState *scan = &ds->scan;
+    free(ds->dupGroups);
+    free(ds->dupGroupPaths);
+    free(scan->dupFiles);
+    while (scan->dupPaths) {
+        StrChunk *next = scan->dupPaths->next;
+        free(scan->dupPaths);
+        scan->dupPaths = next;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Directory tree (DirstatOptions.buildTree). Every walker allocates the TreeDirs
+// of the directories it opens from its own arena and interns their names in
+// its own table, so the scan takes no extra locks; a DirNode fills in its
+// DirstatTreeDir's totals when it finishes. After the scan the arenas are joined
+// and children linked in one pass.
+// ---------------------------------------------------------------------------
+static const char *name_table_intern(NameTable *table, const char *name) {
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        size_t newCap = table->capacity ? table->capacity * 2 : 256;
+        const char **slots = calloc(newCap, sizeof(const char *));
+        if (!slots) {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < table->capacity; i++) {
+            if (!table->slots[i])
+                continue;
+            size_t j = hash_extension(table->slots[i]) & (newCap - 1);
+            while (slots[j])
+                j = (j + 1) & (newCap - 1);
+            slots[j] = table->slots[i];
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->capacity = newCap;
+    }
+    size_t i = hash_extension(name) & (table->capacity - 1);
+    while (table->slots[i]) {
+        if (strcmp(table->slots[i], name) == 0)
+            return table->slots[i];
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->slots[i] = intern_string(&table->strings, name);
+    table->used++;
+    return table->slots[i];
+}
+
+DirstatTreeDir *tree_dir_new(ScanState *scan, DirstatTreeDir *parent, const char *name) {
+    TreeChunk *chunk = scan->treeChunks;
+    if (!chunk || chunk->used == TREE_CHUNK_NODES) {
+        chunk = malloc(sizeof(TreeChunk));
+        if (!chunk) {
+            perror("malloc");
+            exit(1);
+        }
+        chunk->next = scan->treeChunks;
+        chunk->used = 0;
+        scan->treeChunks = chunk;
+    }
+    DirstatTreeDir *d = &chunk->nodes[chunk->used++];
+    memset(d, 0, sizeof(*d));
+    d->parent = parent;
+    d->name = name_table_intern(&scan->treeNames, name);
+    return d;
+}
+
+// Take over a worker's nodes and names; its name lookup table is freed.
+void tree_merge(ScanState *dst, ScanState *src) {
+    while (src->treeChunks) {
+        TreeChunk *next = src->treeChunks->next;
+        src->treeChunks->next = dst->treeChunks;
+        dst->treeChunks = src->treeChunks;
+        src->treeChunks = next;
+    }
+    while (src->treeNames.strings) {
+        StrChunk *next = src->treeNames.strings->next;
+        src->treeNames.strings->next = dst->treeNames.strings;
+        dst->treeNames.strings = src->treeNames.strings;
+        src->treeNames.strings = next;
+    }
+    free(src->treeNames.slots);
+    memset(&src->treeNames, 0, sizeof(src->treeNames));
+}
+
+void tree_free(ScanState *scan) {
+    while (scan->treeChunks) {
+        TreeChunk *next = scan->treeChunks->next;
+        free(scan->treeChunks);
+        scan->treeChunks = next;
+    }
+    while (scan->treeNames.strings) {
+        StrChunk *next = scan->treeNames.strings->next;
+        free(scan->treeNames.strings);
+        scan->treeNames.strings = next;
+    }
+    free(scan->treeNames.slots);
+    memset(&scan->treeNames, 0, sizeof(scan->treeNames));
+}
+
+// Link every node to its parent's child list; returns the root, or NULL if
+// the scanned path was not a directory.
+DirstatTreeDir *tree_link(ScanState *scan) {
+    DirstatTreeDir *root = NULL;
+    for (TreeChunk *c = scan->treeChunks; c; c = c->next) {
+        for (size_t i = 0; i < c->used; i++) {
+            DirstatTreeDir *d = &c->nodes[i];
+            if (d->parent) {
+                d->nextSibling = d->parent->firstChild;
+                d->parent->firstChild = d;
+            } else {
+                root = d;
+            }
+        }
+    }
+    return root;
+}
+
+static long long tree_key(const DirstatTreeDir *d, DirstatTreeKey key) {
+    switch (key) {
+        case DIRSTAT_TREE_BY_LINES:
+            return d->lines;
+        case DIRSTAT_TREE_BY_FILES:
+            return d->files;
+        default:
+            return d->bytes;
+    }
+}
+
+// Largest first, then by name; `arg` points to the DirstatTreeKey.
+static int compare_tree_desc(const void *a, const void *b, void *arg) {
+    const DirstatTreeDir *da = *(const DirstatTreeDir *const *) a;
+    const DirstatTreeDir *db = *(const DirstatTreeDir *const *) b;
+    DirstatTreeKey key = *(const DirstatTreeKey *) arg;
+    long long ka = tree_key(da, key), kb = tree_key(db, key);
+    if (ka != kb)
+        return ka < kb ? 1 : -1;
+    return strcmp(da->name, db->name);
+}
+
+void dirstat_sort_dirs(const DirstatTreeDir **dirs, size_t n, DirstatTreeKey key) {
+    qsort_r(dirs, n, sizeof(DirstatTreeDir *), compare_tree_desc, &key);
+}
+
+// The n largest directories below the root, picked with a min-heap of n
+// entries in one pass over the nodes.
+int dirstat_top_dirs(const Dirstat *ds, DirstatTreeKey key, int n, const DirstatTreeDir **heap) {
+    int size = 0;
+    for (TreeChunk *c = ds->scan.treeChunks; c && n > 0; c = c->next) {
+        for (size_t i = 0; i < c->used; i++) {
+            const DirstatTreeDir *d = &c->nodes[i];
+            if (!d->parent)
+                continue;
+            int pos;
+            if (size < n) {
+                pos = size++;
+                // Sift up
+                while (pos > 0 && compare_tree_desc(&heap[(pos - 1) / 2], &d, &key) < 0) {
+                    heap[pos] = heap[(pos - 1) / 2];
+                    pos = (pos - 1) / 2;
+                }
+                heap[pos] = d;
+                continue;
+            }
+            if (compare_tree_desc(&d, &heap[0], &key) >= 0)
+                continue;   // not larger than the smallest kept
+            // Replace the smallest and sift down
+            pos = 0;
+            for (;;) {
+                int child = 2 * pos + 1;
+                if (child >= size)
+                    break;
+                if (child + 1 < size && compare_tree_desc(&heap[child + 1], &heap[child], &key) > 0)
+                    child++;
+                if (compare_tree_desc(&heap[child], &d, &key) <= 0)
+                    break;
+                heap[pos] = heap[child];
+                pos = child;
+            }
+            heap[pos] = d;
+        }
+    }
+    dirstat_sort_dirs(heap, (size_t) size, key);
+    return size;
+}
+
+// Whether directories need a DirNode at all. The directory hook only sees
+// the first scan, not the partial trees dirstat_watch walks again.
+static int dir_nodes_wanted(const Dirstat *ds) {
+    return !ds->updating && (ds->hooks.directory || ds->opts.buildTree);
+}
+
+static DirNode *dir_node_new(ScanState *scan, DirNode *parent, const char *path) {
+    const Dirstat *ds = scan->ds;
+    DirNode *node = calloc(1, sizeof(DirNode));
+    if (!node || (ds->hooks.directory && !(node->path = strdup(path)))) {
+        perror("calloc");
+        exit(1);
+    }
+    node->hooks = &ds->hooks;
+    if (ds->opts.buildTree) {
+        const char *name = parent ? strrchr(path, '/') + 1 : path;
+        node->tree = tree_dir_new(scan, parent ? parent->tree : NULL, name);
+    }
+    node->parent = parent;
+    atomic_init(&node->refs, 1);
+    if (parent)
+        atomic_fetch_add(&parent->refs, 1);
+    return node;
+}
+
+// Drop a reference; a finished subtree writes its record and hands its totals
+// (and itself, as one more directory) to the parent.
+void dir_node_release(DirNode *node) {
+    while (node && atomic_fetch_sub(&node->refs, 1) == 1) {
+        long files = atomic_load(&node->files), dirs = atomic_load(&node->dirs);
+        long long bytes = atomic_load(&node->bytes), lines = atomic_load(&node->lines);
+        long long chars = atomic_load(&node->chars);
+        if (node->path) {
+            DirstatDirTotals totals = {files, dirs, bytes, lines, chars};
+            node->hooks->directory(node->hooks->user, node->path, &totals);
+        }
+        if (node->tree) {
+            node->tree->files = files;
+            node->tree->dirs = dirs;
+            node->tree->bytes = bytes;
+            node->tree->lines = lines;
+        }
+        DirNode *parent = node->parent;
+        if (parent) {
+            atomic_fetch_add(&parent->files, files);
+            atomic_fetch_add(&parent->dirs, dirs + 1);
+            atomic_fetch_add(&parent->bytes, bytes);
+            atomic_fetch_add(&parent->lines, lines);
+            atomic_fetch_add(&parent->chars, chars);
+        }
+        free(node->path);
+        free(node);
+        node = parent;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Set of (dev, ino) pairs already counted, shared by all walkers.
+// Open addressing with 16-byte slots, split into INODE_SET_SHARDS shards by
+// hash so --jobs workers rarely contend on the same lock. Inode 0 is never
+// a real file, so an all-zero slot is empty.
+// ---------------------------------------------------------------------------
+typedef struct {
+    uint64_t dev, ino;
+} InodeKey;
+
+typedef struct {
+    pthread_mutex_t lock;
+    InodeKey *slots;
+    size_t capacity, used;   // capacity is a power of two
+} InodeShard;
+
+struct InodeSet {
+    InodeShard shards[INODE_SET_SHARDS];
+};
+
+static uint64_t inode_hash(uint64_t dev, uint64_t ino) {
+    uint64_t h = ino * 0x9E3779B97F4A7C15ULL ^ (dev + 0x632BE59BD9B4E019ULL);
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+InodeSet *inode_set_new(void) {
+    InodeSet *set = calloc(1, sizeof(InodeSet));
+    if (!set) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < INODE_SET_SHARDS; i++)
+        pthread_mutex_init(&set->shards[i].lock, NULL);
+    return set;
+}
+
+void inode_set_free(InodeSet *set) {
+    if (!set)
+        return;
+    for (int i = 0; i < INODE_SET_SHARDS; i++) {
+        pthread_mutex_destroy(&set->shards[i].lock);
+        free(set->shards[i].slots);
+    }
+    free(set);
+}
+
+static InodeKey *inode_shard_find(InodeShard *shard, uint64_t hash, uint64_t dev, uint64_t ino) {
+    size_t mask = shard->capacity - 1;
+    size_t i = (size_t) (hash / INODE_SET_SHARDS) & mask;
+    while (shard->slots[i].ino != 0 && (shard->slots[i].dev != dev || shard->slots[i].ino != ino))
+        i = (i + 1) & mask;
+    return &shard->slots[i];
+}
+
+// Add (dev, ino); returns 1 if it was new, 0 if it was already in the set.
+// A NULL set treats everything as new.
+int inode_set_insert(InodeSet *set, dev_t dev, ino_t ino) {
+    if (!set || ino == 0)
+        return 1;
+    uint64_t hash = inode_hash((uint64_t) dev, (uint64_t) ino);
+    InodeShard *shard = &set->shards[hash % INODE_SET_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->used + 1) * 4 > shard->capacity * 3) {
+        // Grow at 75% load and rehash.
+        InodeKey *old = shard->slots;
+        size_t oldCapacity = shard->capacity;
+        shard->capacity = oldCapacity ? oldCapacity * 2 : 64;
+        shard->slots = calloc(shard->capacity, sizeof(InodeKey));
+        if (!shard->slots) {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].ino != 0)
+                *inode_shard_find(shard, inode_hash(old[i].dev, old[i].ino), old[i].dev, old[i].ino) = old[i];
+        }
+        free(old);
+    }
+    InodeKey *slot = inode_shard_find(shard, hash, (uint64_t) dev, (uint64_t) ino);
+    int isNew = (slot->ino == 0);
+    if (isNew) {
+        slot->dev = (uint64_t) dev;
+        slot->ino = (uint64_t) ino;
+        shard->used++;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return isNew;
+}
+
+// Remove (dev, ino) again (--watch, when a counted entry goes away). The
+// entries after it in its probe sequence are shifted back into the hole.
+void inode_set_remove(InodeSet *set, dev_t dev, ino_t ino) {
+    if (!set || ino == 0)
+        return;
+    uint64_t hash = inode_hash((uint64_t) dev, (uint64_t) ino);
+    InodeShard *shard = &set->shards[hash % INODE_SET_SHARDS];
+    pthread_mutex_lock(&shard->lock);
+    InodeKey *slot = shard->capacity ? inode_shard_find(shard, hash, (uint64_t) dev, (uint64_t) ino) : NULL;
+    if (slot && slot->ino != 0) {
+        size_t mask = shard->capacity - 1;
+        size_t hole = (size_t) (slot - shard->slots);
+        for (size_t i = (hole + 1) & mask; shard->slots[i].ino != 0; i = (i + 1) & mask) {
+            InodeKey *k = &shard->slots[i];
+            size_t home = (size_t) (inode_hash(k->dev, k->ino) / INODE_SET_SHARDS) & mask;
+            // Move it unless its home lies cyclically in (hole, i].
+            int stays = (hole <= i) ? (home > hole && home <= i) : (home > hole || home <= i);
+            if (!stays) {
+                shard->slots[hole] = *k;
+                hole = i;
+            }
+        }
+        shard->slots[hole] = (InodeKey){0, 0};
+        shard->used--;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// ---------------------------------------------------------------------------
+// Directory handle reference counting
+// ---------------------------------------------------------------------------
+static DirHandle *dir_handle_new(int fd) {
+    DirHandle *dir = malloc(sizeof(DirHandle));
+    if (!dir) {
+        perror("malloc");
+        exit(1);
+    }
+    dir->fd = fd;
+    atomic_init(&dir->refs, 1);
+    dir->queued = NULL;
+    dir->node = NULL;
+    dir->wd = -1;
+    dir->dev = 0;
+    dir->ino = 0;
+    return dir;
+}
+
+void dir_handle_release(DirHandle *dir) {
+    if (atomic_fetch_sub(&dir->refs, 1) == 1) {
+        if (dir->fd >= 0)
+            close(dir->fd);
+        if (dir->queued)
+            atomic_fetch_sub(dir->queued, 1);
+        if (dir->node)
+            dir_node_release(dir->node);
+        free(dir);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Work-stealing queue for --jobs=N.
+// Every worker owns a deque of pending entries. The owner pushes and pops at
+// the tail (depth-first, keeps the hot directory in cache); idle workers steal
+// from the head, which holds the oldest and therefore usually the largest
+// subtrees. `pending` counts entries pushed but not yet fully processed; the
+// scan is done once it drops to zero.
+// A batch scan (dirstat_scan_batch) feeds the entries of all its roots
+// through one queue; every item names the root it belongs to.
+// A directory stays open while any of its entries is queued. Once half the
+// share of the open file limit a serial walk may use is taken by such
+// directories, workers walk the entries they pop themselves, each with its
+// slice of the other half, instead of queueing more.
+// ---------------------------------------------------------------------------
+typedef struct {
+    DirHandle *parent;     // NULL for the root, which is opened by path
+    char *path;            // full path; the entry's name starts at path + nameOffset
+    size_t nameOffset;
+    unsigned char type;    // d_type from the parent's listing
+    WalkContext ctx;       // the parent's context
+    int scan;              // which root: index into the worker's walker states
+} WorkItem;
+
+typedef struct {
+    pthread_mutex_t lock;
+    WorkItem *items;
+    size_t head;       // next item to steal
+    size_t tail;       // one past the item the owner pops next
+    size_t capacity;
+} WorkDeque;
+
+struct WorkQueue {
+    WorkDeque *deques;
+    int numWorkers;
+    int numScans;      // roots scanned together; each worker has a ScanState per root
+    atomic_long pending;
+    atomic_long openDirs;   // directories open for their queued entries
+    long maxOpenDirs;       // queue no more entries beyond this many
+    size_t walkOpen;        // open directories a worker's own walk may keep
+};
+
+static void work_push(WorkQueue *q, int worker, WorkItem item) {
+    WorkDeque *d = &q->deques[worker];
+    atomic_fetch_add(&q->pending, 1);
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->capacity) {
+        if (d->head > 0) {
+            memmove(d->items, d->items + d->head, (d->tail - d->head) * sizeof(WorkItem));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            d->capacity = (d->capacity == 0) ? 64 : (d->capacity * 2);
+            d->items = realloc(d->items, d->capacity * sizeof(WorkItem));
+            if (!d->items) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+    }
+    d->items[d->tail++] = item;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int work_pop(WorkQueue *q, int worker, WorkItem *item) {
+    WorkDeque *d = &q->deques[worker];
+    int found = 0;
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        *item = d->items[--d->tail];
+        found = 1;
+        if (d->tail == d->head)
+            d->head = d->tail = 0;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static int work_steal(WorkQueue *q, int thief, WorkItem *item) {
+    for (int i = 1; i < q->numWorkers; i++) {
+        WorkDeque *d = &q->deques[(thief + i) % q->numWorkers];
+        int found = 0;
+        pthread_mutex_lock(&d->lock);
+        if (d->tail > d->head) {
+            *item = d->items[d->head++];
+            found = 1;
+            if (d->tail == d->head)
+                d->head = d->tail = 0;
+        }
+        pthread_mutex_unlock(&d->lock);
+        if (found)
+            return 1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Walker path and directory-entry buffers.
+// scan->path always holds the full path of the entry being visited; it is
+// extended and truncated by one component at a time rather than rebuilt.
+// scan->entries is a stack: each open directory's listing sits above its
+// parent's and is popped when the directory is done.
+// ---------------------------------------------------------------------------
+static void path_set(ScanState *scan, const char *path) {
+    size_t len = strlen(path);
+    scan->path = grow_array(scan->path, &scan->pathCap, len + 1, 1);
+    memcpy(scan->path, path, len + 1);
+    scan->pathLen = len;
+}
+
+static void path_truncate(ScanState *scan, size_t len) {
+    scan->pathLen = len;
+    scan->path[len] = '\0';
+}
+
+static void path_append(ScanState *scan, const char *name) {
+    size_t len = strlen(name);
+    scan->path = grow_array(scan->path, &scan->pathCap, scan->pathLen + len + 2, 1);
+    scan->path[scan->pathLen++] = '/';
+    memcpy(scan->path + scan->pathLen, name, len + 1);
+    scan->pathLen += len;
+}
+
+static void entries_append(ScanState *scan, const char *data, size_t len) {
+    scan->entries = grow_array(scan->entries, &scan->entriesCap, scan->entriesLen + len, 1);
+    memcpy(scan->entries + scan->entriesLen, data, len);
+    scan->entriesLen += len;
+}
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Append the entries of the directory open at `fd` to scan->entries with
+// large getdents64 calls. Returns the number of entries added.
+static uint32_t read_dir_entries(ScanState *scan, int fd) {
+    if (!scan->direntBuf) {
+        scan->direntBuf = malloc(DIRENT_BUF_SIZE);
+        if (!scan->direntBuf) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    uint32_t count = 0;
+    for (;;) {
+        unsigned long long t = profile_start();
+        long n = syscall(SYS_getdents64, fd, scan->direntBuf, DIRENT_BUF_SIZE);
+        profile_phase(PHASE_READDIR, t, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        for (long off = 0; off < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(scan->direntBuf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' || (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+            entries_append(scan, (const char *) &d->d_type, 1);
+            entries_append(scan, d->d_name, strlen(d->d_name) + 1);
+            count++;
+        }
+    }
+    return count;
+}
+
+// statx `name` relative to `dirfd` and fill the fields of `st` this program
+// uses: mode, dev, ino, nlink, size, mtime, ctime. `flags` is 0 to follow a symlink
+// or AT_SYMLINK_NOFOLLOW.
+static int stat_at(int dirfd, const char *name, unsigned mask, int flags, struct stat *st) {
+    struct statx stx;
+    unsigned long long t = profile_start();
+    int ret = statx(dirfd, name, AT_STATX_SYNC_AS_STAT | flags, mask | STATX_TYPE, &stx);
+    profile_phase(PHASE_STAT, t, 1);
+    if (ret != 0)
+        return -1;
+    memset(st, 0, sizeof(*st));
+    st->st_mode = stx.stx_mode;
+    st->st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st->st_ino = stx.stx_ino;
+    st->st_nlink = stx.stx_nlink;
+    st->st_size = (off_t) stx.stx_size;
+    st->st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+    return 0;
+}
+
+// The statx fields a regular file called `name` needs; 0 if it can be read
+// without any stat at all.
+static unsigned file_statx_mask(const ScanState *scan, const char *name) {
+    const DirstatOptions *opts = &scan->ds->opts;
+    unsigned mask = 0;
+    if (scan->cache || scan->recordCache)
+        mask |= STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME;
+    if (opts->ioBackend == DIRSTAT_IO_MMAP || opts->estimateMode ||
+        binary_extension(scan->ds, dirstat_file_extension(name)))
+        mask |= STATX_SIZE;
+    if (opts->duplicates)
+        mask |= STATX_INO | STATX_SIZE;
+    if (scan->skipName && strcmp(name, scan->skipName) == 0)
+        mask |= STATX_INO;
+    if (opts->dedupHardlinks)
+        mask |= STATX_INO | STATX_NLINK;
+    return mask;
+}
+
+// ---------------------------------------------------------------------------
+// Open directory `name` in `parent`, count it and push its listing onto
+// scan->entries as [*begin, *end). Listings come from the cache when the
+// directory's mtime is unchanged. Returns the open handle, or NULL if it
+// cannot be opened, was already walked or is on another file system with -x.
+// ---------------------------------------------------------------------------
+static DirHandle *open_directory(ScanState *scan, DirHandle *parent, const char *name, size_t *begin, size_t *end) {
+    unsigned long long started = profile_start();
+    int fd = openat(parent ? parent->fd : AT_FDCWD, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int openErrno = errno;
+    unsigned long long t = profile_phase(PHASE_OPENDIR, started, 1);
+    if (fd < 0) {
+        scan_check_fds(scan, scan->path, openErrno);
+        return NULL;
+    }
+    // When symlinks are followed every directory is walked once: this stops
+    // symlink and bind-mount cycles and never lists a directory reached by
+    // two paths twice. Without them, or -x or the cache, no stat is needed.
+    const DirstatOptions *opts = &scan->ds->opts;
+    struct stat st;
+    int haveStat = 0;
+    if (opts->followSymlinks || opts->oneFileSystem || scan->cache || scan->recordCache) {
+        haveStat = fstat(fd, &st) == 0;
+        profile_phase(PHASE_STAT, t, 1);
+    }
+    if (haveStat && ((opts->oneFileSystem && st.st_dev != scan->rootDev) ||
+                     !inode_set_insert(scan->seen, st.st_dev, st.st_ino))) {
+        close(fd);
+        return NULL;
+    }
+    scan->projStats.numDirs++;
+    *begin = scan->entriesLen;
+    const CacheDirEntry *cachedDir = haveStat ? cache_lookup_dir(scan->cache, &st) : NULL;
+    uint32_t count = 0;
+    if (cachedDir) {
+        // Unchanged since the cache was written: same entries as last time.
+        const char *first = scan->cache->names + cachedDir->namesOffset;
+        const char *p = first;
+        const char *namesEnd = scan->cache->names + scan->cache->header->namesSize;
+        for (; count < cachedDir->numNames && p + 1 < namesEnd; count++)
+            p += strlen(p + 1) + 2;
+        entries_append(scan, first, (size_t)(p - first));
+    } else {
+        count = read_dir_entries(scan, fd);
+    }
+    *end = scan->entriesLen;
+    if (haveStat && scan->recordCache)
+        cache_record_dir(scan, &st, scan->entries + *begin, *end - *begin, count);
+    if (scan->profile)
+        profile_dir(scan->profile, scan->path, profile_now() - started);
+    DirHandle *dir = dir_handle_new(fd);
+    if (haveStat) {
+        dir->dev = st.st_dev;
+        dir->ino = st.st_ino;
+    }
+    if (dir_nodes_wanted(scan->ds))
+        dir->node = dir_node_new(scan, parent ? parent->node : NULL, scan->path);
+    return dir;
+}
+
+static int listing_contains(const ScanState *scan, size_t begin, size_t end, const char *name) {
+    for (size_t cursor = begin; cursor < end;) {
+        const char *entry = scan->entries + cursor + 1;
+        if (strcmp(entry, name) == 0)
+            return 1;
+        cursor += strlen(entry) + 2;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Visit one entry of a directory walked with context `in`; scan->path holds
+// its full path. Plain --exclude patterns are checked before anything else;
+// glob patterns and .gitignore rules once the entry's type is known, so
+// ignored directories are never opened.
+// `type` is the d_type from the parent's listing: regular files and
+// directories are only stat'ed when the cache or I/O backend needs it;
+// symlinks and DT_UNKNOWN always are, and symlinks are followed.
+// Regular files are counted here. For a directory, its open handle is
+// returned with its listing on scan->entries as [*begin, *end) and the
+// context for its entries in `out` (out->ignore is a new reference).
+// ---------------------------------------------------------------------------
+static DirHandle *visit_entry(ScanState *scan, DirHandle *parent, const char *name, unsigned char type,
+                              const WalkContext *in, WalkContext *out, size_t *begin, size_t *end) {
+    int excludeState = in->excludeState;
+    if (parent)
+        excludeState = exclude_advance(scan->excludes, excludeState, "/");
+    if (excludeState >= 0)
+        excludeState = exclude_advance(scan->excludes, excludeState, name);
+    if (excludeState < 0)
+        return NULL;
+    // The root is always followed; symlinks below it only with --follow-symlinks.
+    const DirstatOptions *opts = &scan->ds->opts;
+    int follow = opts->followSymlinks || !parent;
+    if (type == DT_LNK && !follow)
+        return NULL;
+    struct stat st;
+    int haveStat = 0;
+    unsigned mask = (type == DT_DIR) ? 0 : file_statx_mask(scan, name);
+    if (type == DT_UNKNOWN || type == DT_LNK || mask != 0) {
+        if (stat_at(parent ? parent->fd : AT_FDCWD, name, mask, follow ? 0 : AT_SYMLINK_NOFOLLOW, &st) != 0)
+            return NULL;
+        haveStat = 1;
+        type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+    }
+    if (type != DT_REG && type != DT_DIR)
+        return NULL;
+    int isDir = (type == DT_DIR);
+    if (parent) {
+        const char *relPath = scan->path + scan->rootLen + 1;
+        if (exclude_glob_match(scan->excludes, relPath, name, isDir))
+            return NULL;
+        if (scan->useGitignore &&
+            ((isDir && strcmp(name, ".git") == 0) || ignore_list_match(in->ignore, scan->path, name, isDir)))
+            return NULL;
+    }
+    if (!isDir) {
+        if (haveStat && st.st_dev == scan->skipDev && st.st_ino == scan->skipIno)
+            return NULL;
+        // Other links to a file already counted (and, when following
+        // symlinks, files also reached through a link) are skipped.
+        if (haveStat && opts->dedupHardlinks && (st.st_nlink > 1 || opts->followSymlinks) &&
+            !inode_set_insert(scan->seen, st.st_dev, st.st_ino))
+            return NULL;
+        if (opts->oneFileSystem && haveStat && st.st_dev != scan->rootDev)
+            return NULL;
+        scan->projStats.numFiles++;
+        scan_regular_file(scan, parent, name, haveStat ? &st : NULL);
+        return NULL;
+    }
+    DirHandle *dir = open_directory(scan, parent, name, begin, end);
+    if (!dir)
+        return NULL;
+    out->excludeState = excludeState;
+    if (scan->useGitignore && listing_contains(scan, *begin, *end, ".gitignore")) {
+        out->ignore = ignore_list_load(dir->fd, in->ignore, scan->pathLen);
+    } else {
+        out->ignore = in->ignore;
+        if (out->ignore)
+            atomic_fetch_add(&out->ignore->refs, 1);
+    }
+    if (scan->watch)
+        watch_add_dir(scan, dir, parent, out);
+    return dir;
+}
+
+// ---------------------------------------------------------------------------
+// Process a file or directory path.
+// Skips anything matched by the --exclude patterns or, with --gitignore, by
+// .gitignore files.
+// Directories are walked depth-first with an explicit stack of handles
+// instead of recursion. Only the deepest keep their fd open, up to a share
+// of the open file limit; an ancestor's fd is closed while its subtree is walked and reopened through
+// the child's ".." on the way back up (or, if that is not where the walk came
+// from, as with followed symlinks, by name from the nearest open ancestor),
+// so nesting depth is not bounded by the open file limit.
+// ---------------------------------------------------------------------------
+typedef struct {
+    DirHandle *dir;
+    size_t begin;      // this directory's listing in scan->entries
+    size_t cursor;
+    size_t end;
+    size_t pathLen;
+    WalkContext ctx;
+} DirFrame;
+
+// Directories walk_entry may keep open at once.
+static size_t open_frames_limit(void) {
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) != 0 || nofile.rlim_cur == RLIM_INFINITY)
+        return SIZE_MAX;
+    size_t limit = (size_t) nofile.rlim_cur / DIR_OPEN_FRAMES_SHARE;
+    return limit < DIR_OPEN_FRAMES_MIN ? DIR_OPEN_FRAMES_MIN : limit;
+}
+
+// Close the fd of a frame deep above the walk, unless it could not be told
+// apart on reopening. Returns 0 to try again later if the handle is still
+// shared (queued io_uring opens).
+static int frame_close(DirFrame *f) {
+    if (f->dir->fd < 0)
+        return 1;
+    if (atomic_load(&f->dir->refs) != 1)
+        return 0;
+    struct stat st;
+    if (f->dir->ino == 0) {
+        // open_directory did not need to stat it.
+        if (fstat(f->dir->fd, &st) != 0)
+            return 1;
+        f->dir->dev = st.st_dev;
+        f->dir->ino = st.st_ino;
+    }
+    close(f->dir->fd);
+    f->dir->fd = -1;
+    return 1;
+}
+
+// Give frames[k] its fd back if `fd` is the directory it had. Otherwise
+// `fd` is closed.
+static int frame_adopt(DirFrame *f, int fd) {
+    struct stat st;
+    if (fd < 0)
+        return 0;
+    if (fstat(fd, &st) != 0 || st.st_dev != f->dir->dev || st.st_ino != f->dir->ino) {
+        close(fd);
+        return 0;
+    }
+    f->dir->fd = fd;
+    return 1;
+}
+
+// Reopen frames[k] by name, one component at a time from the nearest
+// ancestor that is still open. frames[0] is `name` in `parent`; the names of
+// the others are in scan->path. Returns 0 if the directory is gone or moved.
+static int frame_reopen(ScanState *scan, DirFrame *frames, size_t k, DirHandle *parent, const char *name) {
+    size_t j = k;
+    while (j > 0 && frames[j - 1].dir->fd < 0)
+        j--;
+    int fd = j > 0 ? frames[j - 1].dir->fd : (parent ? parent->fd : AT_FDCWD);
+    for (; j <= k; j++) {
+        char component[NAME_MAX + 1];
+        const char *open = name;
+        if (j > 0) {
+            size_t start = frames[j - 1].pathLen + 1, len = frames[j].pathLen - start;
+            if (len > NAME_MAX)
+                break;
+            memcpy(component, scan->path + start, len);
+            component[len] = '\0';
+            open = component;
+        }
+        int next = openat(fd, open, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (j > 0 && frames[j - 1].dir->fd != fd)
+            close(fd);
+        fd = next;
+        if (fd < 0)
+            return 0;
+    }
+    if (j <= k) {
+        close(fd);
+        return 0;
+    }
+    return frame_adopt(&frames[k], fd);
+}
+
+// Visit `name` in `parent` (scan->path holds its full path) and, if it is a
+// directory, everything below it, keeping at most `maxOpen` of its
+// directories open.
+static void walk_entry(ScanState *scan, DirHandle *parent, const char *name, unsigned char type,
+                       const WalkContext *in, size_t maxOpen) {
+    size_t begin = 0, end = 0;
+    WalkContext ctx;
+    DirHandle *root = visit_entry(scan, parent, name, type, in, &ctx, &begin, &end);
+    if (!root)
+        return;
+    DirFrame *frames = NULL;
+    size_t numFrames = 0, capFrames = 0;
+    size_t nextClose = 0;   // frames below this are closed (or cannot be)
+    frames = grow_array(frames, &capFrames, 1, sizeof(DirFrame));
+    frames[numFrames++] = (DirFrame){root, begin, begin, end, scan->pathLen, ctx};
+    while (numFrames > 0) {
+        DirFrame *f = &frames[numFrames - 1];
+        if (f->cursor >= f->end) {
+            if (numFrames > 1 && f[-1].dir->fd < 0 && f[-1].cursor < f[-1].end && f->dir->fd >= 0)
+                frame_adopt(&f[-1], openat(f->dir->fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+            dir_handle_release(f->dir);
+            ignore_list_release(f->ctx.ignore);
+            scan->entriesLen = f->begin;
+            numFrames--;
+            if (numFrames > 0 && nextClose >= numFrames)
+                nextClose = numFrames - 1;   // about to be reopened
+            continue;
+        }
+        if (f->dir->fd < 0 && !frame_reopen(scan, frames, numFrames - 1, parent, name)) {
+            f->cursor = f->end;   // removed or renamed while we were below it
+            continue;
+        }
+        unsigned char entryType = (unsigned char) scan->entries[f->cursor];
+        const char *entryName = scan->entries + f->cursor + 1;
+        f->cursor += strlen(entryName) + 2;
+        path_truncate(scan, f->pathLen);
+        path_append(scan, entryName);
+        DirHandle *child = visit_entry(scan, f->dir, entryName, entryType, &f->ctx, &ctx, &begin, &end);
+        if (child) {
+            frames = grow_array(frames, &capFrames, numFrames + 1, sizeof(DirFrame));
+            frames[numFrames++] = (DirFrame){child, begin, begin, end, scan->pathLen, ctx};
+            while (numFrames > maxOpen && nextClose < numFrames - maxOpen && frame_close(&frames[nextClose]))
+                nextClose++;
+        }
+    }
+    free(frames);
+}
+
+void process_path(const char *path, ScanState *scan) {
+    path_set(scan, path);
+    scan->rootLen = scan->pathLen;
+    WalkContext rootIn = {0, NULL};
+    walk_entry(scan, NULL, path, DT_UNKNOWN, &rootIn, open_frames_limit());
+}
+
+// ---------------------------------------------------------------------------
+// --git: count only the files tracked in the root's git index, parsed
+// straight from .git/index (versions 2 to 4) without running git. Nothing
+// is listed with getdents64: the index is sorted by path, so every
+// directory of a tracked file is opened once, as a dirfd for its files,
+// and closed when the index moves past it. The sizes come from the index's
+// cached stat data: with --estimate unsampled files are not even stat'ed,
+// otherwise a file's size is taken from the index when its size and mtime
+// still match the entry.
+// ---------------------------------------------------------------------------
+#define GIT_MODE_TYPE_MASK 0170000
+#define GIT_MODE_REGULAR 0100000
+#define GIT_FLAG_EXTENDED 0x4000
+#define GIT_EXT_SKIP_WORKTREE 0x4000
+
+typedef struct {
+    const unsigned char *data;
+    size_t size, pos;
+    uint32_t version, remaining;
+    size_t hashSize;           // 20 for SHA-1 repositories, 32 for SHA-256
+    char *name;                // path of the current entry, relative to the root
+    size_t nameLen, nameCap;
+    uint32_t mode, fileSize;   // fileSize is the size modulo 2^32, as git stores it
+    uint32_t mtimeSec, mtimeNsec;
+    unsigned stage;            // non-zero for the sides of an unresolved merge
+    int skipWorktree;          // sparse checkout: not in the working tree
+} GitIndexReader;
+
+static uint32_t git_be32(const unsigned char *p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// Read the next entry. Returns 1 for an entry, 0 after the last one and -1
+// if the index is damaged.
+static int git_index_next(GitIndexReader *r) {
+    if (r->remaining == 0)
+        return 0;
+    size_t off = 40 + r->hashSize + 2;   // stat data, object id, flags
+    if (r->pos + off > r->size)
+        return -1;
+    const unsigned char *e = r->data + r->pos;
+    r->mtimeSec = git_be32(e + 8);
+    r->mtimeNsec = git_be32(e + 12);
+    r->mode = git_be32(e + 24);
+    r->fileSize = git_be32(e + 36);
+    unsigned flags = ((unsigned) e[40 + r->hashSize] << 8) | e[41 + r->hashSize];
+    r->stage = (flags >> 12) & 3;
+    r->skipWorktree = 0;
+    if (flags & GIT_FLAG_EXTENDED) {
+        if (r->version < 3 || r->pos + off + 2 > r->size)
+            return -1;
+        r->skipWorktree = (e[off] << 8 | e[off + 1]) & GIT_EXT_SKIP_WORKTREE;
+        off += 2;
+    }
+    size_t keep = 0;
+    if (r->version == 4) {
+        // The name drops a varint-coded number of bytes from the end of the
+        // previous one and appends the rest.
+        size_t p = r->pos + off;
+        if (p >= r->size)
+            return -1;
+        unsigned char c = r->data[p++];
+        size_t strip = c & 127;
+        while (c & 128) {
+            if (p >= r->size || strip > PATH_MAX)
+                return -1;
+            c = r->data[p++];
+            strip = ((strip + 1) << 7) | (c & 127);
+        }
+        if (strip > r->nameLen)
+            return -1;
+        keep = r->nameLen - strip;
+        off = p - r->pos;
+    }
+    const unsigned char *suffix = r->data + r->pos + off;
+    const unsigned char *nul = memchr(suffix, 0, r->size - (r->pos + off));
+    if (!nul)
+        return -1;
+    size_t len = (size_t) (nul - suffix);
+    r->name = grow_array(r->name, &r->nameCap, keep + len + 1, 1);
+    memcpy(r->name + keep, suffix, len);
+    r->nameLen = keep + len;
+    r->name[r->nameLen] = '\0';
+    if (r->version == 4)
+        r->pos = (size_t) (nul - r->data) + 1;
+    else
+        r->pos += (off + len + 8) & ~(size_t) 7;   // NUL-padded to a multiple of 8
+    r->remaining--;
+    return 1;
+}
+
+// Read a small file into a NUL-terminated buffer; NULL if it cannot be read.
+static char *read_small_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    char *buf = malloc(4096);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    size_t n = fread(buf, 1, 4095, f);
+    buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+// Path of the repository's git directory: <root>/.git, or where a .git file
+// (worktrees, submodules) points. Caller frees.
+static char *git_dir_path(const char *root) {
+    size_t len = strlen(root) + sizeof("/.git");
+    char *path = malloc(len);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(path, len, "%s/.git", root);
+    struct stat st;
+    if (stat(path, &st) != 0 || S_ISDIR(st.st_mode))
+        return path;
+    char *content = read_small_file(path);
+    free(path);
+    if (!content || strncmp(content, "gitdir:", 7) != 0) {
+        free(content);
+        return NULL;
+    }
+    char *target = content + 7;
+    while (*target == ' ')
+        target++;
+    target[strcspn(target, "\r\n")] = '\0';
+    len = strlen(root) + strlen(target) + 2;
+    path = malloc(len);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    if (target[0] == '/')
+        snprintf(path, len, "%s", target);
+    else
+        snprintf(path, len, "%s/%s", root, target);
+    free(content);
+    return path;
+}
+
+// Strip the whitespace around a config name or value in place.
+static char *git_config_trim(char *s) {
+    s += strspn(s, " \t");
+    size_t len = strlen(s);
+    while (len > 0 && (s[len - 1] == ' ' || s[len - 1] == '\t' || s[len - 1] == '\r'))
+        len--;
+    s[len] = '\0';
+    return s;
+}
+
+// Whether the config at `path` sets objectFormat = sha256 in its
+// [extensions] section. Section and key names are case-insensitive, and
+// '#' or ';' start a comment outside double quotes.
+static int git_config_sha256(const char *path) {
+    char *config = read_small_file(path);
+    if (!config)
+        return 0;
+    int sha256 = 0, inExtensions = 0;
+    for (char *line = strtok(config, "\n"); line; line = strtok(NULL, "\n")) {
+        int quoted = 0;
+        for (char *c = line; *c; c++) {
+            if (*c == '"')
+                quoted = !quoted;
+            else if (!quoted && (*c == '#' || *c == ';')) {
+                *c = '\0';
+                break;
+            }
+        }
+        line = git_config_trim(line);
+        if (*line == '[') {
+            char *end = strchr(line, ']');
+            if (!end)
+                continue;
+            *end = '\0';
+            inExtensions = strcasecmp(git_config_trim(line + 1), "extensions") == 0;
+            line = git_config_trim(end + 1);   // a variable may follow on the same line
+        }
+        char *eq = strchr(line, '=');
+        if (!inExtensions || !eq)
+            continue;
+        *eq = '\0';
+        if (strcasecmp(git_config_trim(line), "objectformat") != 0)
+            continue;
+        char *value = git_config_trim(eq + 1);
+        size_t len = strlen(value);
+        if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+            value[len - 1] = '\0';
+            value++;
+        }
+        sha256 = strcasecmp(value, "sha256") == 0;   // the last setting wins
+    }
+    free(config);
+    return sha256;
+}
+
+static size_t git_hash_size(const char *gitDir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/config", gitDir);
+    if (git_config_sha256(path))
+        return 32;
+    // A worktree's settings live in the main repository's git directory.
+    snprintf(path, sizeof(path), "%s/commondir", gitDir);
+    char *common = read_small_file(path);
+    if (!common)
+        return 20;
+    common[strcspn(common, "\r\n")] = '\0';
+    if (common[0] == '/')
+        snprintf(path, sizeof(path), "%s/config", common);
+    else
+        snprintf(path, sizeof(path), "%s/%s/config", gitDir, common);
+    free(common);
+    return git_config_sha256(path) ? 32 : 20;
+}
+
+// A directory of the index being visited. `dir` is NULL when it is
+// excluded or missing from the working tree; its files are then skipped.
+typedef struct {
+    DirHandle *dir;
+    size_t pathLen;       // scan->path length with this directory
+    size_t relLen;        // length of its path relative to the root (0: the root)
+    int excludeState;
+} GitFrame;
+
+static void git_frame_release(GitFrame *f) {
+    if (f->dir)
+        dir_handle_release(f->dir);
+}
+
+// Count the tracked files of the git repository at `root`. Returns -1 with a
+// message if its index cannot be used.
+int git_scan(const char *root, ScanState *scan) {
+    char *gitDir = git_dir_path(root);
+    if (!gitDir) {
+        fprintf(stderr, "--git: %s/.git does not point to a git directory\n", root);
+        return -1;
+    }
+    char indexPath[PATH_MAX];
+    snprintf(indexPath, sizeof(indexPath), "%s/index", gitDir);
+    GitIndexReader r;
+    memset(&r, 0, sizeof(r));
+    r.hashSize = git_hash_size(gitDir);
+    free(gitDir);
+    int fd = open(indexPath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "--git: cannot read %s: %s\n", indexPath, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    r.size = (size_t) st.st_size;
+    void *map = r.size >= 12 ? mmap(NULL, r.size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "--git: %s is not a git index\n", indexPath);
+        return -1;
+    }
+    r.data = map;
+    r.version = git_be32(r.data + 4);
+    r.remaining = git_be32(r.data + 8);
+    r.pos = 12;
+    if (memcmp(r.data, "DIRC", 4) != 0 || r.version < 2 || r.version > 4) {
+        fprintf(stderr, "--git: %s is not a git index of version 2 to 4\n", indexPath);
+        munmap(map, r.size);
+        return -1;
+    }
+    // Check the whole index, and that it is not split, before counting.
+    GitIndexReader check = r;
+    int ret;
+    while ((ret = git_index_next(&check)) > 0)
+        ;
+    for (size_t p = check.pos; ret == 0 && p + 8 + r.hashSize <= r.size; p += 8 + git_be32(r.data + p + 4)) {
+        if (memcmp(r.data + p, "link", 4) == 0) {
+            fprintf(stderr, "--git: split indexes are not supported (git update-index --no-split-index)\n");
+            ret = -1;
+        }
+    }
+    free(check.name);
+    if (ret < 0) {
+        if (ret == -1 && check.remaining > 0)
+            fprintf(stderr, "--git: %s is damaged\n", indexPath);
+        munmap(map, r.size);
+        return -1;
+    }
+
+    path_set(scan, root);
+    scan->rootLen = scan->pathLen;
+    int rootState = exclude_advance(scan->excludes, 0, root);
+    int rootFd = rootState < 0 ? -1 : open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (rootFd < 0) {
+        munmap(map, r.size);
+        return 0;
+    }
+    scan->projStats.numDirs++;
+    GitFrame *frames = NULL;
+    size_t numFrames = 0, capFrames = 0;
+    frames = grow_array(frames, &capFrames, 1, sizeof(GitFrame));
+    frames[numFrames++] = (GitFrame){dir_handle_new(rootFd), scan->pathLen, 0, rootState};
+    if (dir_nodes_wanted(scan->ds))
+        frames[0].dir->node = dir_node_new(scan, NULL, root);
+    char component[NAME_MAX + 1];
+    while ((ret = git_index_next(&r)) > 0) {
+        // Symlinks, submodules, sparse directories, entries outside the
+        // sparse checkout and the base/theirs sides of conflicts are skipped.
+        if ((r.mode & GIT_MODE_TYPE_MASK) != GIT_MODE_REGULAR || r.skipWorktree || r.stage == 1 || r.stage == 3)
+            continue;
+        // Leave the directories this entry is not in.
+        while (numFrames > 1) {
+            GitFrame *f = &frames[numFrames - 1];
+            if (r.nameLen > f->relLen && r.name[f->relLen] == '/' &&
+                memcmp(r.name, scan->path + scan->rootLen + 1, f->relLen) == 0)
+                break;
+            git_frame_release(f);
+            numFrames--;
+        }
+        GitFrame *top = &frames[numFrames - 1];
+        path_truncate(scan, top->pathLen);
+        // Enter the directories between it and the entry.
+        size_t start = top->relLen ? top->relLen + 1 : 0;
+        const char *slash;
+        while ((slash = strchr(r.name + start, '/')) != NULL) {
+            size_t len = (size_t) (slash - (r.name + start));
+            if (len > NAME_MAX)
+                len = NAME_MAX;
+            memcpy(component, r.name + start, len);
+            component[len] = '\0';
+            path_append(scan, component);
+            int state = top->excludeState;
+            DirHandle *dir = NULL;
+            if (top->dir) {
+                state = exclude_advance(scan->excludes, state, "/");
+                if (state >= 0)
+                    state = exclude_advance(scan->excludes, state, component);
+                int dirFd = -1;
+                if (state >= 0 && !exclude_glob_match(scan->excludes, scan->path + scan->rootLen + 1, component, 1))
+                    dirFd = openat(top->dir->fd, component, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                if (dirFd >= 0) {
+                    scan->projStats.numDirs++;
+                    dir = dir_handle_new(dirFd);
+                    if (dir_nodes_wanted(scan->ds))
+                        dir->node = dir_node_new(scan, top->dir->node, scan->path);
+                }
+            }
+            frames = grow_array(frames, &capFrames, numFrames + 1, sizeof(GitFrame));
+            frames[numFrames++] = (GitFrame){dir, scan->pathLen, (size_t) (slash - r.name), state};
+            top = &frames[numFrames - 1];
+            start = (size_t) (slash - r.name) + 1;
+        }
+        if (!top->dir)
+            continue;
+        const char *name = r.name + start;
+        int state = exclude_advance(scan->excludes, top->excludeState, "/");
+        if (state >= 0)
+            state = exclude_advance(scan->excludes, state, name);
+        if (state < 0 || exclude_glob_match(scan->excludes, r.name, name, 0))
+            continue;
+        path_append(scan, name);
+        if (scan->ds->opts.estimateMode) {
+            // Trust the index: the size git recorded at its last refresh.
+            memset(&st, 0, sizeof(st));
+            st.st_mode = S_IFREG | 0644;
+            st.st_nlink = 1;
+            st.st_size = (off_t) r.fileSize;
+            st.st_mtim.tv_sec = (time_t) r.mtimeSec;
+            st.st_mtim.tv_nsec = (long) r.mtimeNsec;
+        } else {
+            unsigned mask = file_statx_mask(scan, name) | STATX_SIZE | STATX_MTIME;
+            if (stat_at(top->dir->fd, name, mask, AT_SYMLINK_NOFOLLOW, &st) != 0 || !S_ISREG(st.st_mode))
+                continue;   // deleted or replaced in the working tree
+            // Unchanged since git last refreshed it: reuse the size git
+            // recorded, keeping the bits above 4 GB it leaves out.
+            if ((uint32_t) st.st_size == r.fileSize && (uint32_t) st.st_mtim.tv_sec == r.mtimeSec &&
+                (uint32_t) st.st_mtim.tv_nsec == r.mtimeNsec)
+                st.st_size = (off_t) (((uint64_t) st.st_size & ~(uint64_t) 0xffffffffU) | r.fileSize);
+            if (st.st_dev == scan->skipDev && st.st_ino == scan->skipIno)
+                continue;
+            if (scan->ds->opts.dedupHardlinks && st.st_nlink > 1 &&
+                !inode_set_insert(scan->seen, st.st_dev, st.st_ino))
+                continue;
+        }
+        scan->projStats.numFiles++;
+        scan_regular_file(scan, top->dir, name, &st);
+    }
+    while (numFrames > 0)
+        git_frame_release(&frames[--numFrames]);
+    free(frames);
+    free(r.name);
+    munmap(map, r.size);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// --watch: after the first scan, keep the statistics current from inotify
+// events instead of rescanning. Every counted file keeps a WatchFile with
+// what it added to the totals, found by directory and name; every watched
+// directory a WatchDir, found by its watch descriptor. Events only queue
+// the names that changed. At most once per interval the queued names are
+// applied in two passes: first the old records are subtracted (a removed
+// or renamed directory takes its whole subtree with it), then each name is
+// visited again as in a walk, which re-reads a changed file and walks a new
+// directory. An update costs in proportion to what changed, not to the
+// size of the tree.
+// ---------------------------------------------------------------------------
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ONLYDIR | IN_EXCL_UNLINK)
+
+typedef struct WatchDir WatchDir;
+
+typedef struct WatchFile {
+    struct WatchFile *hashNext;        // next in its hash bucket
+    struct WatchFile *prev, *next;     // files of the same directory
+    WatchDir *dir;
+    const char *ext;                   // interned in the scan's ExtTable
+    DirstatFileStats stats;            // what it added to the totals
+    dev_t dev;                         // in scan->seen, else ino 0
+    ino_t ino;
+    char name[];
+} WatchFile;
+
+struct WatchDir {
+    int wd;
+    char *path;                        // full path
+    WatchDir *parent, *firstChild, *nextSibling;
+    WatchFile *files;
+    WalkContext ctx;                   // for its entries; holds a reference to ctx.ignore
+    dev_t dev;                         // in scan->seen
+    ino_t ino;
+};
+
+typedef struct {
+    int wd;
+    char *name;
+} WatchEvent;
+
+struct Watcher {
+    int fd;                            // the inotify instance
+    WatchDir **dirs;                   // indexed by watch descriptor
+    size_t capDirs;
+    WatchDir **unwatched;              // directories inotify refused, by -2 - wd
+    size_t numUnwatched, capUnwatched;
+    WatchDir *root;
+    WatchFile **buckets;               // files by (watch descriptor, name)
+    size_t numBuckets, numFiles;
+    WatchEvent *events;                // names changed since the last update
+    size_t numEvents, capEvents;
+    int overflow;                      // events were lost: rescan everything
+    int warned;                        // a directory could not be watched
+};
+
+static Watcher *watcher_new(void) {
+    Watcher *w = calloc(1, sizeof(Watcher));
+    if (!w) {
+        perror("calloc");
+        exit(1);
+    }
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) {
+        perror("inotify_init1");
+        exit(1);
+    }
+    return w;
+}
+
+void watcher_free(Watcher *w) {
+    if (!w)
+        return;
+    for (size_t i = 0; i < w->capDirs + w->numUnwatched; i++) {
+        WatchDir *d = i < w->capDirs ? w->dirs[i] : w->unwatched[i - w->capDirs];
+        if (!d)
+            continue;
+        for (WatchFile *f = d->files, *next; f; f = next) {
+            next = f->next;
+            free(f);
+        }
+        ignore_list_release(d->ctx.ignore);
+        free(d->path);
+        free(d);
+    }
+    for (size_t i = 0; i < w->numEvents; i++)
+        free(w->events[i].name);
+    close(w->fd);
+    free(w->dirs);
+    free(w->unwatched);
+    free(w->buckets);
+    free(w->events);
+    free(w);
+}
+
+static WatchDir *watch_dir(const Watcher *w, int wd) {
+    if (wd >= 0)
+        return (size_t) wd < w->capDirs ? w->dirs[wd] : NULL;
+    return (wd < -1 && (size_t) (-2 - (long) wd) < w->numUnwatched) ? w->unwatched[-2 - (long) wd] : NULL;
+}
+
+static size_t watch_bucket(size_t numBuckets, int wd, const char *name) {
+    return (size_t) (hash_extension(name) ^ (unsigned long long) wd * 0x9E3779B97F4A7C15ULL) & (numBuckets - 1);
+}
+
+// Watch the directory visit_entry has just opened as `dir` (scan->path);
+// `ctx` is the context for its entries. A directory inotify refuses is still
+// recorded, under a descriptor below -1, so its files are subtracted with it.
+void watch_add_dir(ScanState *scan, DirHandle *dir, const DirHandle *parent, const WalkContext *ctx) {
+    Watcher *w = scan->watch;
+    int wd = inotify_add_watch(w->fd, scan->path, WATCH_EVENTS);
+    if (wd < 0 || watch_dir(w, wd)) {
+        if (!w->warned)
+            fprintf(stderr, "--watch: cannot watch %s%s%s; changes there are not seen\n", scan->path,
+                    wd < 0 ? ": " : "", wd < 0 ? strerror(errno) : " twice");
+        w->warned = 1;
+        w->unwatched = grow_array(w->unwatched, &w->capUnwatched, w->numUnwatched + 1, sizeof(WatchDir *));
+        wd = -2 - (int) w->numUnwatched++;
+        w->unwatched[-2 - wd] = NULL;
+    }
+    WatchDir *d = calloc(1, sizeof(WatchDir));
+    if (!d || !(d->path = strdup(scan->path))) {
+        perror("calloc");
+        exit(1);
+    }
+    d->wd = wd;
+    struct stat st;
+    if (fstat(dir->fd, &st) == 0) {
+        d->dev = st.st_dev;
+        d->ino = st.st_ino;
+    }
+    d->ctx = *ctx;
+    if (ctx->ignore)
+        atomic_fetch_add(&ctx->ignore->refs, 1);
+    d->parent = parent ? watch_dir(w, parent->wd) : NULL;
+    if (d->parent) {
+        d->nextSibling = d->parent->firstChild;
+        d->parent->firstChild = d;
+    } else if (!parent) {
+        w->root = d;
+    }
+    if (wd < 0) {
+        w->unwatched[-2 - wd] = d;
+    } else {
+        if ((size_t) wd >= w->capDirs) {
+            size_t oldCap = w->capDirs;
+            w->dirs = grow_array(w->dirs, &w->capDirs, (size_t) wd + 1, sizeof(WatchDir *));
+            memset(w->dirs + oldCap, 0, (w->capDirs - oldCap) * sizeof(WatchDir *));
+        }
+        w->dirs[wd] = d;
+    }
+    dir->wd = wd;
+}
+
+// Remember what the file `name` in `dir` added to the totals.
+void watch_record_file(ScanState *scan, const DirHandle *dir, const char *name, const char *ext,
+                       DirstatFileStats fstats, const struct stat *st) {
+    Watcher *w = scan->watch;
+    WatchDir *d = watch_dir(w, dir->wd);
+    if (!d)
+        return;
+    if (w->numFiles >= w->numBuckets) {
+        size_t newBuckets = w->numBuckets ? w->numBuckets * 2 : 1024;
+        WatchFile **buckets = calloc(newBuckets, sizeof(WatchFile *));
+        if (!buckets) {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < w->numBuckets; i++) {
+            for (WatchFile *f = w->buckets[i], *next; f; f = next) {
+                next = f->hashNext;
+                size_t b = watch_bucket(newBuckets, f->dir->wd, f->name);
+                f->hashNext = buckets[b];
+                buckets[b] = f;
+            }
+        }
+        free(w->buckets);
+        w->buckets = buckets;
+        w->numBuckets = newBuckets;
+    }
+    size_t len = strlen(name);
+    WatchFile *f = malloc(sizeof(WatchFile) + len + 1);
+    if (!f) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(f->name, name, len + 1);
+    f->dir = d;
+    f->ext = ext_table_get(&scan->exts, ext)->ext;
+    f->stats = fstats;
+    // Every file goes in the seen set, not just those with several links:
+    // a hardlink created later must find the name already counted.
+    f->dev = 0;
+    f->ino = 0;
+    if (st && scan->ds->opts.dedupHardlinks) {
+        inode_set_insert(scan->seen, st->st_dev, st->st_ino);
+        f->dev = st->st_dev;
+        f->ino = st->st_ino;
+    }
+    f->prev = NULL;
+    f->next = d->files;
+    if (d->files)
+        d->files->prev = f;
+    d->files = f;
+    size_t b = watch_bucket(w->numBuckets, d->wd, name);
+    f->hashNext = w->buckets[b];
+    w->buckets[b] = f;
+    w->numFiles++;
+}
+
+// Subtract a file's record from the totals and drop it.
+static void watch_forget_file(ScanState *scan, WatchFile *f) {
+    Watcher *w = scan->watch;
+    DirstatProjectStats *p = &scan->projStats;
+    p->numFiles--;
+    p->stats.bytes -= f->stats.bytes;
+    p->stats.lines -= f->stats.lines;
+    p->stats.chars -= f->stats.chars;
+    p->stats.binaryFiles -= f->stats.binaryFiles;
+    p->stats.binaryBytes -= f->stats.binaryBytes;
+    p->stats.codeLines -= f->stats.codeLines;
+    p->stats.commentLines -= f->stats.commentLines;
+    p->stats.blankLines -= f->stats.blankLines;
+    DirstatExtCount *e = ext_table_get(&scan->exts, f->ext);
+    e->count--;
+    e->bytes -= f->stats.bytes;
+    e->lines -= f->stats.lines;
+    e->chars -= f->stats.chars;
+    e->codeLines -= f->stats.codeLines;
+    e->commentLines -= f->stats.commentLines;
+    e->blankLines -= f->stats.blankLines;
+    inode_set_remove(scan->seen, f->dev, f->ino);
+    WatchFile **link = &w->buckets[watch_bucket(w->numBuckets, f->dir->wd, f->name)];
+    while (*link != f)
+        link = &(*link)->hashNext;
+    *link = f->hashNext;
+    if (f->prev)
+        f->prev->next = f->next;
+    else
+        f->dir->files = f->next;
+    if (f->next)
+        f->next->prev = f->prev;
+    w->numFiles--;
+    free(f);
+}
+
+static WatchFile *watch_find_file(const Watcher *w, const WatchDir *d, const char *name) {
+    if (w->numBuckets == 0)
+        return NULL;
+    WatchFile *f = w->buckets[watch_bucket(w->numBuckets, d->wd, name)];
+    while (f && (f->dir != d || strcmp(f->name, name) != 0))
+        f = f->hashNext;
+    return f;
+}
+
+// Subtract a directory and everything below it, and stop watching them.
+static void watch_remove_dir(ScanState *scan, WatchDir *d) {
+    Watcher *w = scan->watch;
+    if (d->parent) {
+        WatchDir **link = &d->parent->firstChild;
+        while (*link != d)
+            link = &(*link)->nextSibling;
+        *link = d->nextSibling;
+    } else if (w->root == d) {
+        w->root = NULL;
+    }
+    WatchDir **stack = NULL;
+    size_t numStack = 0, capStack = 0;
+    stack = grow_array(stack, &capStack, 1, sizeof(WatchDir *));
+    stack[numStack++] = d;
+    while (numStack > 0) {
+        WatchDir *cur = stack[--numStack];
+        for (WatchDir *child = cur->firstChild; child; child = child->nextSibling) {
+            stack = grow_array(stack, &capStack, numStack + 1, sizeof(WatchDir *));
+            stack[numStack++] = child;
+        }
+        while (cur->files)
+            watch_forget_file(scan, cur->files);
+        if (cur->wd >= 0) {
+            // Fails harmlessly when the directory is already gone.
+            inotify_rm_watch(w->fd, cur->wd);
+            w->dirs[cur->wd] = NULL;
+        } else {
+            w->unwatched[-2 - cur->wd] = NULL;
+        }
+        inode_set_remove(scan->seen, cur->dev, cur->ino);
+        scan->projStats.numDirs--;
+        ignore_list_release(cur->ctx.ignore);
+        free(cur->path);
+        free(cur);
+    }
+    free(stack);
+    while (w->numUnwatched > 0 && !w->unwatched[w->numUnwatched - 1])
+        w->numUnwatched--;
+}
+
+static void watch_queue(Watcher *w, int wd, const char *name) {
+    if (w->numEvents > 0 && w->events[w->numEvents - 1].wd == wd &&
+        strcmp(w->events[w->numEvents - 1].name, name) == 0)
+        return;   // a file being written sends a stream of the same event
+    w->events = grow_array(w->events, &w->capEvents, w->numEvents + 1, sizeof(WatchEvent));
+    WatchEvent *ev = &w->events[w->numEvents++];
+    ev->wd = wd;
+    if (!(ev->name = strdup(name))) {
+        perror("strdup");
+        exit(1);
+    }
+}
+
+// Queue the names of every pending inotify event.
+static void watch_read_events(ScanState *scan) {
+    Watcher *w = scan->watch;
+    char buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW)
+                w->overflow = 1;
+            WatchDir *d = watch_dir(w, ev->wd);
+            if (ev->len == 0 || !d)
+                continue;
+            if (scan->useGitignore && strcmp(ev->name, ".gitignore") == 0) {
+                // New rules for the whole directory: visit it again.
+                if (d->parent)
+                    watch_queue(w, d->parent->wd, strrchr(d->path, '/') + 1);
+                else
+                    w->overflow = 1;
+                continue;
+            }
+            watch_queue(w, ev->wd, ev->name);
+        }
+    }
+}
+
+static int compare_watch_events(const void *a, const void *b) {
+    const WatchEvent *x = a, *y = b;
+    if (x->wd != y->wd)
+        return x->wd < y->wd ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+// Apply the queued events to the totals.
+static void watch_update(Dirstat *ds) {
+    ScanState *scan = &ds->scan;
+    Watcher *w = scan->watch;
+    if (w->overflow) {
+        // Some changes are unknown: start over with a fresh walk.
+        if (w->root)
+            watch_remove_dir(scan, w->root);
+        process_path(ds->root, scan);
+        w->overflow = 0;
+    } else {
+        qsort(w->events, w->numEvents, sizeof(WatchEvent), compare_watch_events);
+        // Subtract everything first, so a directory or hardlink that moved
+        // within the tree is no longer in the seen set when it is visited
+        // under its new name.
+        for (size_t i = 0; i < w->numEvents; i++) {
+            WatchDir *d = watch_dir(w, w->events[i].wd);
+            if (!d)
+                continue;   // inside a directory removed by an earlier event
+            const char *name = w->events[i].name;
+            for (WatchDir *child = d->firstChild; child; child = child->nextSibling) {
+                if (strcmp(strrchr(child->path, '/') + 1, name) == 0) {
+                    watch_remove_dir(scan, child);
+                    break;
+                }
+            }
+            WatchFile *f = watch_find_file(w, d, name);
+            if (f)
+                watch_forget_file(scan, f);
+        }
+        DirHandle *parent = NULL;
+        for (size_t i = 0; i < w->numEvents; i++) {
+            const WatchEvent *ev = &w->events[i];
+            if (i > 0 && compare_watch_events(ev, ev - 1) == 0)
+                continue;
+            WatchDir *d = watch_dir(w, ev->wd);
+            if (!d)
+                continue;
+            if (!parent || parent->wd != d->wd) {
+                if (parent)
+                    dir_handle_release(parent);
+                int fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                parent = fd >= 0 ? dir_handle_new(fd) : NULL;
+                if (!parent)
+                    continue;
+                parent->wd = d->wd;
+            }
+            path_set(scan, d->path);
+            path_append(scan, ev->name);
+            walk_entry(scan, parent, ev->name, DT_UNKNOWN, &d->ctx, open_frames_limit());
+        }
+        if (parent)
+            dir_handle_release(parent);
+    }
+    for (size_t i = 0; i < w->numEvents; i++)
+        free(w->events[i].name);
+    w->numEvents = 0;
+}
+
+// Wait for changes and apply them, at most every `interval` seconds, until
+// `changed` asks to stop.
+void dirstat_watch(Dirstat *ds, double interval, int (*changed)(Dirstat *ds, void *user), void *user) {
+    Watcher *w = ds->scan.watch;
+    if (!w)
+        return;
+    unsigned long long intervalNs = (unsigned long long) (interval * 1e9);
+    unsigned long long lastUpdate = profile_now();
+    for (;;) {
+        int timeout = -1;
+        if (w->numEvents > 0 || w->overflow) {
+            unsigned long long now = profile_now(), due = lastUpdate + intervalNs;
+            if (now >= due) {
+                ds->updating = 1;
+                watch_update(ds);
+                ds->updating = 0;
+                if (changed(ds, user))
+                    return;
+                lastUpdate = profile_now();
+                continue;
+            }
+            timeout = (int) ((due - now + 999999) / 1000000);
+        }
+        struct pollfd pfd = {w->fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            exit(1);
+        }
+        watch_read_events(&ds->scan);
+    }
+}
+
+// Visit a queued entry. A directory's entries are pushed for any worker to
+// pick up rather than walked here, unless too many directories are already
+// open for their queued entries.
+static void process_work_item(WorkItem *item, ScanState *scan) {
+    WorkQueue *q = scan->queue;
+    path_set(scan, item->path);
+    if (atomic_load(&q->openDirs) >= q->maxOpenDirs) {
+        walk_entry(scan, item->parent, item->path + item->nameOffset, item->type, &item->ctx, q->walkOpen);
+        return;
+    }
+    size_t begin = 0, end = 0;
+    WalkContext ctx;
+    DirHandle *dir = visit_entry(scan, item->parent, item->path + item->nameOffset, item->type,
+                                 &item->ctx, &ctx, &begin, &end);
+    if (!dir)
+        return;
+    size_t pathLen = scan->pathLen;
+    if (begin < end) {
+        dir->queued = &q->openDirs;
+        atomic_fetch_add(&q->openDirs, 1);
+    }
+    for (size_t cursor = begin; cursor < end;) {
+        unsigned char type = (unsigned char) scan->entries[cursor];
+        const char *name = scan->entries + cursor + 1;
+        cursor += strlen(name) + 2;
+        path_truncate(scan, pathLen);
+        path_append(scan, name);
+        WorkItem child = {dir, strdup(scan->path), pathLen + 1, type, ctx, item->scan};
+        if (!child.path) {
+            perror("strdup");
+            exit(1);
+        }
+        atomic_fetch_add(&dir->refs, 1);
+        if (ctx.ignore)
+            atomic_fetch_add(&ctx.ignore->refs, 1);
+        work_push(q, scan->workerId, child);
+    }
+    scan->entriesLen = begin;
+    dir_handle_release(dir);
+    ignore_list_release(ctx.ignore);
+}
+
+// `arg` points to the worker's walker states, one per root. They share the
+// first one's io_uring ring.
+static void *scan_worker(void *arg) {
+    ScanState *states = arg;
+    WorkQueue *q = states->queue;
+    int workerId = states->workerId;
+    long idleNs = 0;
+    scan_io_begin(states);
+    for (int i = 1; i < q->numScans; i++)
+        states[i].ring = states->ring;
+    for (;;) {
+        WorkItem item;
+        if (!work_pop(q, workerId, &item) && !work_steal(q, workerId, &item)) {
+            // Finish our own queued reads before waiting on anyone else.
+            if (states->ring && states->ring->inFlight > 0) {
+                uring_drain(states->ring);
+                continue;
+            }
+            if (atomic_load(&q->pending) == 0)
+                break;
+            // Nothing to steal yet, but others are still expanding directories.
+            idleNs = (idleNs == 0) ? 1000 : (idleNs < 1000000 ? idleNs * 2 : idleNs);
+            struct timespec ts = {0, idleNs};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        idleNs = 0;
+        process_work_item(&item, &states[item.scan]);
+        if (item.parent)
+            dir_handle_release(item.parent);
+        ignore_list_release(item.ctx.ignore);
+        free(item.path);
+        atomic_fetch_sub(&q->pending, 1);
+    }
+    scan_io_end(states);
+    for (int i = 1; i < q->numScans; i++)
+        states[i].ring = NULL;
+    return NULL;
+}
+
+// Release a walker's path and listing buffers.
+static void scan_free_buffers(ScanState *scan) {
+    free(scan->path);
+    free(scan->entries);
+    free(scan->direntBuf);
+    scan->path = scan->entries = scan->direntBuf = NULL;
+    scan->pathLen = scan->pathCap = scan->entriesLen = scan->entriesCap = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Scan the roots of `scans` with `jobs` worker threads and merge their
+// per-thread results into each one's ScanState. Every worker keeps a walker
+// state per root, so the roots share the threads: a worker done with a small
+// root steals from the big ones. Totals are identical to the serial walk.
+// ---------------------------------------------------------------------------
+void scan_parallel(Dirstat **scans, int numScans, int jobs) {
+    WorkQueue q;
+    q.numWorkers = jobs;
+    q.numScans = numScans;
+    atomic_init(&q.pending, 0);
+    atomic_init(&q.openDirs, 0);
+    size_t maxOpen = open_frames_limit();
+    q.maxOpenDirs = maxOpen == SIZE_MAX ? LONG_MAX : (long) (maxOpen / 2);
+    q.walkOpen = maxOpen == SIZE_MAX ? SIZE_MAX : (maxOpen - maxOpen / 2) / jobs;
+    if (q.walkOpen == 0)
+        q.walkOpen = 1;
+    q.deques = calloc(jobs, sizeof(WorkDeque));
+    ScanState *workers = calloc((size_t) jobs * numScans, sizeof(ScanState));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    if (!q.deques || !workers || !threads) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < jobs; i++)
+        pthread_mutex_init(&q.deques[i].lock, NULL);
+    for (int i = 0; i < jobs * numScans; i++) {
+        ScanState *scan = &scans[i % numScans]->scan;
+        workers[i].ds = scan->ds;
+        workers[i].excludes = scan->excludes;
+        workers[i].useGitignore = scan->useGitignore;
+        workers[i].rootLen = strlen(scan->ds->root);
+        workers[i].queue = &q;
+        workers[i].workerId = i / numScans;
+        workers[i].cache = scan->cache;
+        workers[i].recordCache = scan->recordCache;
+        workers[i].skipDev = scan->skipDev;
+        workers[i].skipIno = scan->skipIno;
+        workers[i].seen = scan->seen;
+        workers[i].rootDev = scan->rootDev;
+        workers[i].skipName = scan->skipName;
+        if (scan->profile) {
+            workers[i].profile = calloc(1, sizeof(ScanProfile));
+            if (!workers[i].profile) {
+                perror("calloc");
+                exit(1);
+            }
+        }
+    }
+
+    // The roots are dealt out round-robin; whatever a worker does not get
+    // to first is stolen by the others.
+    for (int i = 0; i < numScans; i++) {
+        WorkItem item = {NULL, strdup(scans[i]->root), 0, DT_UNKNOWN, {0, NULL}, i};
+        if (!item.path) {
+            perror("strdup");
+            exit(1);
+        }
+        work_push(&q, i % jobs, item);
+    }
+
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, scan_worker, &workers[started * numScans]) != 0)
+            break;
+    }
+    if (started == 0) {
+        // Could not start any thread; fall back to running the only worker
+        // inline, stealing the roots dealt to the others.
+        scan_worker(&workers[0]);
+    }
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (int i = 0; i < jobs * numScans; i++) {
+        ScanState *scan = &scans[i % numScans]->scan;
+        scan->projStats.numFiles += workers[i].projStats.numFiles;
+        scan->projStats.numDirs += workers[i].projStats.numDirs;
+        scan->projStats.stats.bytes += workers[i].projStats.stats.bytes;
+        scan->projStats.stats.lines += workers[i].projStats.stats.lines;
+        scan->projStats.stats.chars += workers[i].projStats.stats.chars;
+        scan->projStats.stats.binaryFiles += workers[i].projStats.stats.binaryFiles;
+        scan->projStats.stats.binaryBytes += workers[i].projStats.stats.binaryBytes;
+        scan->projStats.stats.codeLines += workers[i].projStats.stats.codeLines;
+        scan->projStats.stats.commentLines += workers[i].projStats.stats.commentLines;
+        scan->projStats.stats.blankLines += workers[i].projStats.stats.blankLines;
+        merge_extension_counts(&scan->exts, &workers[i].exts);
+        tree_merge(scan, &workers[i]);
+        if (scan->recordCache)
+            cache_merge_records(scan, &workers[i]);
+        dup_merge(scan, &workers[i]);
+        if (scan->profile)
+            profile_merge(scan->profile, workers[i].profile);
+        profile_free(workers[i].profile);
+        ext_table_free(&workers[i].exts);
+        scan_free_buffers(&workers[i]);
+    }
+    for (int i = 0; i < jobs; i++) {
+        free(q.deques[i].items);
+        pthread_mutex_destroy(&q.deques[i].lock);
+    }
+    free(threads);
+    free(workers);
+    free(q.deques);
+}
+
+// ---------------------------------------------------------------------------
+// Comparison function for sorting extensions in descending order (highest % first)
+// ---------------------------------------------------------------------------
+int compare_ext_desc(const void *a, const void *b, void *caseSensitive) {
+    (void) caseSensitive;
+    const DirstatExtCount *ea = (const DirstatExtCount*) a;
+    const DirstatExtCount *eb = (const DirstatExtCount*) b;
+    if (ea->count < eb->count)
+        return 1;
+    else if (ea->count > eb->count)
+        return -1;
+    else
+        return strcmp(ea->ext, eb->ext);
+}
+
+// ---------------------------------------------------------------------------
+// Format a byte count for the table, e.g. "812 B", "14.2 KB", "3.07 GB".
+// ---------------------------------------------------------------------------
+void dirstat_format_size(long long bytes, char *buffer, size_t buflen) {
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB", "PB"};
+    double value = (double) bytes;
+    int unit = 0;
+    while (value >= 1024.0 && unit < 5) {
+        value /= 1024.0;
+        unit++;
+    }
+    if (unit == 0)
+        snprintf(buffer, buflen, "%lld B", bytes);
+    else
+        snprintf(buffer, buflen, "%.*f %s", value < 10.0 ? 2 : 1, value, units[unit]);
+}
+
+// ---------------------------------------------------------------------------
+// The libdirstat.h API
+// ---------------------------------------------------------------------------
+void dirstat_options_init(DirstatOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->jobs = 1;
+    opts->ioBackend = DIRSTAT_IO_SYNC;
+    opts->estimateRate = ESTIMATE_DEFAULT_RATE / 100.0;
+    opts->binaryDetect = 1;
+    opts->followSymlinks = 1;
+}
+
+// Where the cache of `root` is kept by default: $XDG_CACHE_HOME/dirstat/
+// (~/.cache/dirstat/ without it), named after the FNV-1a hash of the root's
+// real path. NULL if there is no cache directory to use.
+static char *default_cache_path(const char *root) {
+    char real[PATH_MAX];
+    if (!realpath(root, real))
+        return NULL;
+    const char *base = getenv("XDG_CACHE_HOME"), *suffix = "";
+    if (!base || base[0] != '/') {
+        // The XDG spec says to ignore relative paths.
+        base = getenv("HOME");
+        suffix = "/.cache";
+        if (!base || base[0] != '/')
+            return NULL;
+    }
+    size_t len = strlen(base) + strlen(suffix) + sizeof("/" CACHE_DIR_NAME "/") + 16;
+    char *path = malloc(len);
+    if (!path) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(path, len, "%s%s/" CACHE_DIR_NAME "/%016llx", base, suffix, hash_extension(real));
+    return path;
+}
+
+// Set up the Dirstat of `root` up to the point where its walk can start.
+// Returns NULL after printing why if it cannot be scanned.
+static Dirstat *scan_prepare(const char *root, const DirstatOptions *opts, const DirstatHooks *hooks) {
+    Dirstat *ds = calloc(1, sizeof(Dirstat));
+    if (!ds || !(ds->root = strdup(root))) {
+        perror("calloc");
+        exit(1);
+    }
+    ds->opts = *opts;
+    ds->opts.excludes = ds->opts.binaryExts = NULL;
+    ds->opts.numExcludes = ds->opts.numBinaryExts = 0;
+    ds->opts.cachePath = NULL;
+    if (hooks)
+        ds->hooks = *hooks;
+    if (ds->opts.jobs < 1)
+        ds->opts.jobs = 1;
+    if (ds->opts.watch) {
+        // Updates are applied by one thread, file by file as they are read.
+        ds->opts.jobs = 1;
+        if (ds->opts.ioBackend == DIRSTAT_IO_URING)
+            ds->opts.ioBackend = DIRSTAT_IO_SYNC;
+    }
+    binary_exts_init(ds, opts->binaryExts, opts->numBinaryExts);
+    ScanState *scan = &ds->scan;
+    scan->ds = ds;
+    ds->excludes = exclude_compile(opts->excludes, opts->numExcludes);
+    scan->excludes = ds->excludes;
+    scan->useGitignore = opts->useGitignore;
+    scan->seen = inode_set_new();
+    // Unlike unreadable entries below it, which are skipped, a root that
+    // cannot be stat'ed or read (listed and entered, for a directory) fails
+    // the scan.
+    struct stat rootSt, cacheSt;
+    if (stat(root, &rootSt) != 0 ||
+        faccessat(AT_FDCWD, root, S_ISDIR(rootSt.st_mode) ? R_OK | X_OK : R_OK, AT_EACCESS) != 0) {
+        fprintf(stderr, "%s: %s\n", root, strerror(errno));
+        dirstat_free(ds);
+        return NULL;
+    }
+    scan->rootDev = rootSt.st_dev;
+    int rootIsDir = S_ISDIR(rootSt.st_mode);
+    if (opts->watch) {
+        if (!rootIsDir) {
+            fprintf(stderr, "--watch needs a directory\n");
+            dirstat_free(ds);
+            return NULL;
+        }
+        scan->watch = watcher_new();
+    }
+    if (opts->profile) {
+        scan->profile = calloc(1, sizeof(ScanProfile));
+        if (!scan->profile) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+
+    // The cache is only written into the tree when opts->cachePath puts it there.
+    if (opts->cachePath) {
+        if (!(ds->cachePath = strdup(opts->cachePath))) {
+            perror("strdup");
+            exit(1);
+        }
+    } else if (opts->useCache && rootIsDir) {
+        ds->cachePath = default_cache_path(root);
+    }
+    if (ds->cachePath && stat(ds->cachePath, &cacheSt) == 0) {
+        scan->skipDev = cacheSt.st_dev;
+        scan->skipIno = cacheSt.st_ino;
+        const char *slash = strrchr(ds->cachePath, '/');
+        scan->skipName = slash ? slash + 1 : ds->cachePath;
+    }
+    // Estimates are neither taken from nor written to the cache. --git scans
+    // use it but do not replace it: they see only part of the tree; nor do
+    // --watch scans, which would see their own cache file appear.
+    if (ds->cachePath && opts->useCache && !opts->rebuildCache && !opts->estimateMode)
+        ds->cache = cache_open(ds->cachePath, opts->binaryDetect, opts->classify);
+    scan->cache = ds->cache;
+    scan->recordCache = (ds->cachePath && opts->useCache && !opts->estimateMode && !opts->gitMode && !opts->watch);
+    ds->scanStart = time(NULL);
+    ds->scanStartNs = profile_now();
+    return ds;
+}
+
+// Walk the root of `ds` on the calling thread; -1 if its git index cannot be read.
+static int scan_serial(Dirstat *ds) {
+    ScanState *scan = &ds->scan;
+    int ret = 0;
+    scan_io_begin(scan);
+    if (ds->opts.gitMode)
+        ret = git_scan(ds->root, scan);
+    else
+        process_path(ds->root, scan);
+    scan_io_end(scan);
+    return atomic_load(&ds->outOfFds) ? -1 : ret;
+}
+
+// Write the cache, find the duplicates and finish the totals once the walk
+// is done.
+static void scan_finish(Dirstat *ds) {
+    ScanState *scan = &ds->scan;
+    const DirstatOptions *opts = &ds->opts;
+    if (scan->recordCache)
+        cache_write(ds->cachePath, scan, ds->scanStart);
+    if (opts->duplicates)
+        dup_find(ds);
+    ds->wallSec = (profile_now() - ds->scanStartNs) / 1e9;
+    getrusage(RUSAGE_SELF, &ds->usage);
+    free(scan->cacheFiles);
+    free(scan->cacheDirs);
+    free(scan->cacheNames);
+    scan->cacheFiles = NULL;
+    scan->cacheDirs = NULL;
+    scan->cacheNames = NULL;
+    scan->recordCache = 0;
+
+    if (opts->estimateMode) {
+        int count = 0;
+        estimate_settle(&scan->exts);
+        DirstatExtCount *entries = ext_table_entries(&scan->exts, &count);
+        ds->linesCi = estimate_finish(entries, count, &scan->projStats);
+        for (int i = 0; i < count; i++) {
+            DirstatExtCount *e = ext_table_get(&scan->exts, entries[i].ext);
+            e->lines = entries[i].lines;
+            e->linesCi = entries[i].linesCi;
+        }
+        free(entries);
+    }
+    if (opts->buildTree)
+        ds->tree = tree_link(scan);
+}
+
+Dirstat *dirstat_scan(const char *root, const DirstatOptions *opts, const DirstatHooks *hooks) {
+    if (opts->watch && (opts->estimateMode || opts->gitMode || opts->buildTree || opts->duplicates || opts->profile)) {
+        fprintf(stderr, "--watch cannot be combined with --estimate, --git, --top, --depth, --duplicates or --profile\n");
+        return NULL;
+    }
+    if (opts->classify && opts->estimateMode) {
+        fprintf(stderr, "--classify cannot be combined with --estimate\n");
+        return NULL;
+    }
+    Dirstat *ds = scan_prepare(root, opts, hooks);
+    if (!ds)
+        return NULL;
+    if (ds->opts.jobs > 1 && !opts->gitMode) {
+        scan_parallel(&ds, 1, ds->opts.jobs);
+        if (atomic_load(&ds->outOfFds)) {
+            dirstat_free(ds);
+            return NULL;
+        }
+    } else if (scan_serial(ds) < 0) {
+        dirstat_free(ds);
+        return NULL;
+    }
+    scan_finish(ds);
+    return ds;
+}
+
+// --git batches: every root is one task, taken by the next free thread.
+typedef struct {
+    Dirstat **scans;
+    int *failed;
+    int numScans;
+    atomic_int next;
+} GitBatch;
+
+static void *git_batch_worker(void *arg) {
+    GitBatch *b = arg;
+    for (int i; (i = atomic_fetch_add(&b->next, 1)) < b->numScans;) {
+        if (b->scans[i])
+            b->failed[i] = scan_serial(b->scans[i]) < 0;
+    }
+    return NULL;
+}
+
+int dirstat_scan_batch(const char **roots, int numRoots, const DirstatOptions *opts, const DirstatHooks *hooks,
+                       Dirstat **out) {
+    if (opts->watch || opts->profile) {
+        fprintf(stderr, "--watch and --profile cannot be combined with several roots\n");
+        return -1;
+    }
+    if (opts->cachePath && numRoots > 1) {
+        fprintf(stderr, "--cache-file cannot be combined with several roots\n");
+        return -1;
+    }
+    if (opts->classify && opts->estimateMode) {
+        fprintf(stderr, "--classify cannot be combined with --estimate\n");
+        return -1;
+    }
+    if (numRoots <= 0)
+        return 0;
+    int *failed = calloc(numRoots, sizeof(int));
+    if (!failed) {
+        perror("calloc");
+        exit(1);
+    }
+    Dirstat **ready = malloc(numRoots * sizeof(Dirstat *));
+    if (!ready) {
+        perror("malloc");
+        exit(1);
+    }
+    int numReady = 0;
+    for (int i = 0; i < numRoots; i++) {
+        out[i] = scan_prepare(roots[i], opts, hooks);
+        if (out[i])
+            ready[numReady++] = out[i];
+        else
+            failed[i] = 1;
+    }
+    int jobs = opts->jobs > 1 ? opts->jobs : 1;
+    if (opts->gitMode) {
+        GitBatch b = {out, failed, numRoots, 0};
+        pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+        if (!threads) {
+            perror("calloc");
+            exit(1);
+        }
+        int started = 0;
+        for (; started < jobs && started < numRoots; started++) {
+            if (pthread_create(&threads[started], NULL, git_batch_worker, &b) != 0)
+                break;
+        }
+        if (started == 0)
+            git_batch_worker(&b);
+        for (int i = 0; i < started; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    } else if (jobs > 1 && numReady > 0) {
+        scan_parallel(ready, numReady, jobs);
+    } else {
+        for (int i = 0; i < numReady; i++)
+            scan_serial(ready[i]);
+    }
+    free(ready);
+    int numFailed = 0;
+    for (int i = 0; i < numRoots; i++) {
+        if (failed[i] || (out[i] && atomic_load(&out[i]->outOfFds))) {
+            dirstat_free(out[i]);
+            out[i] = NULL;
+            numFailed++;
+        } else {
+            scan_finish(out[i]);
+        }
+    }
+    free(failed);
+    return numFailed;
+}
+
+void dirstat_free(Dirstat *ds) {
+    if (!ds)
+        return;
+    ScanState *scan = &ds->scan;
+    watcher_free(scan->watch);
+    cache_close(ds->cache);
+    free(scan->cacheFiles);
+    free(scan->cacheDirs);
+    free(scan->cacheNames);
+    scan_free_buffers(scan);
+    exclude_free(ds->excludes);
+    inode_set_free(scan->seen);
+    profile_free(scan->profile);
+    ext_table_free(&scan->exts);
+    tree_free(scan);
+    dup_free(ds);
+    for (size_t i = 0; i < ds->numBinaryExts; i++)
+        free(ds->binaryExts[i]);
+    free(ds->binaryExts);
+    free(ds->cachePath);
+    free(ds->root);
+    free(ds);
+}
+
+const DirstatProjectStats *dirstat_totals(const Dirstat *ds) {
+    return &ds->scan.projStats;
+}
+
+double dirstat_lines_ci(const Dirstat *ds) {
+    return ds->linesCi;
+}
+
+const DirstatDupGroup *dirstat_duplicates(const Dirstat *ds, int *count) {
+    *count = ds->numDupGroups;
+    return ds->numDupGroups < 0 ? NULL : ds->dupGroups;
+}
+
+const DirstatTreeDir *dirstat_tree(const Dirstat *ds) {
+    return ds->tree;
+}
+
+DirstatExtCount *dirstat_extensions(const Dirstat *ds, DirstatSortType sort, int caseSensitive, int *count) {
+    DirstatExtCount *extCounts = ext_table_entries(&ds->scan.exts, count);
+    for (int i = 0; ds->opts.classify && i < *count; i++) {
+        const Language *lang = extension_language(extCounts[i].ext);
+        extCounts[i].language = lang ? lang->name : NULL;
+    }
+    int (*compare)(const void *, const void *, void *) = compare_ext_desc;
+    switch (sort) {
+        case DIRSTAT_SORT_DESCENDING:
+            compare = compare_ext_desc;
+            break;
+        case DIRSTAT_SORT_ASCENDING:
+        case DIRSTAT_SORT_NUM_ASC:
+            compare = compare_ext_num_asc;
+            break;
+        case DIRSTAT_SORT_ALPHA_ASC:
+            compare = compare_ext_asc;
+            break;
+        case DIRSTAT_SORT_ALPHA_DESC:
+        case DIRSTAT_SORT_NATURAL_DESC:
+            compare = compare_ext_natural_desc;
+            break;
+        case DIRSTAT_SORT_NUM_DESC:
+            compare = compare_ext_num_desc;
+            break;
+        case DIRSTAT_SORT_NATURAL_ASC:
+            compare = compare_ext_natural_asc;
+            break;
+        case DIRSTAT_SORT_SIZE_ASC:
+            compare = compare_ext_size_asc;
+            break;
+        case DIRSTAT_SORT_SIZE_DESC:
+            compare = compare_ext_size_desc;
+            break;
+    }
+    if (*count > 0)
+        qsort_r(extCounts, (size_t) *count, sizeof(DirstatExtCount), compare, &caseSensitive);
+    return extCounts;
+}
+
+void dirstat_print_profile(const Dirstat *ds, FILE *out, int json, int ascii) {
+    if (!ds->scan.profile)
+        return;
+    if (json)
+        profile_print_json(out, ds->scan.profile, ds->wallSec, &ds->usage, ds->opts.jobs);
+    else
+        profile_print(out, ds->scan.profile, ds->wallSec, &ds->usage, ds->opts.jobs, ascii);
+}
@@ -0,0 +1,234 @@
+#ifndef LIBDIRSTAT_H
+#define LIBDIRSTAT_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+// ---------------------------------------------------------------------------
+// libdirstat: the scanning core of dirstat-project-size as a library.
+//
+// A scan is described by a DirstatOptions and an optional set of hooks, and
+// its results live in the Dirstat it returns. Everything a scan changes is
+// in its Dirstat, so any number of scans may run at the same time on
+// different threads. The only process-wide state is the newline-counting
+// kernel, picked for the CPU once on first use (pthread_once). The library
+// installs no signal handlers: with DIRSTAT_IO_MMAP a file truncated while
+// it is being counted raises SIGBUS, left to the program's disposition.
+// The hooks are called from the scan's walker threads (more than one at a
+// time with jobs > 1) and must be thread-safe in that case.
+//
+//   DirstatOptions opts;
+//   dirstat_options_init(&opts);
+//   opts.jobs = 8;
+//   Dirstat *ds = dirstat_scan("/path/to/project", &opts, NULL);
+//   if (ds) {
+//       int n;
+//       DirstatExtCount *exts = dirstat_extensions(ds, DIRSTAT_SORT_DESCENDING, 0, &n);
+//       ...
+//       free(exts);
+//       dirstat_free(ds);
+//   }
+//
+// Like the command-line tool, the library reports out of memory by exiting;
+// only duplicates gives up instead, see dirstat_duplicates.
+// ---------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------
+// Results
+// ---------------------------------------------------------------------------
+typedef struct {
+    long long bytes;   // total bytes
+    long long lines;   // total lines (number of '\n')
+    long long chars;   // total characters read
+    long long binaryFiles;   // binary files among them, counted by size only
+    long long binaryBytes;   // their bytes, also included in `bytes`
+    long long codeLines;     // classify: `lines` of files in a known language split three ways
+    long long commentLines;
+    long long blankLines;
+} DirstatFileStats;
+
+typedef struct {
+    long numFiles;
+    long numDirs;
+    DirstatFileStats stats;
+} DirstatProjectStats;
+
+// --estimate: sums over the sampled small files of one extension, for a
+// ratio estimate of lines per byte. Large and known binary files are all
+// visited instead.
+typedef struct {
+    long n;
+    double bytes, lines;        // bytes read and lines found in them
+    double bb, ll, lb;          // sums of squares and products
+    long long knownBytes;       // bytes of large and binary files, already in DirstatExtCount.lines
+} DirstatEstimateSample;
+
+typedef struct {
+    const char *ext;   // file extension (e.g., "c", "cpp", "py"), owned by the Dirstat
+    long count;
+    long long bytes;   // per-extension totals, same meaning as in DirstatFileStats
+    long long lines;
+    long long chars;
+    long long codeLines, commentLines, blankLines;
+    const char *language;           // classify: the extension's language, NULL if not known
+    long dupFiles;                  // duplicates: copies of files seen elsewhere, and their bytes
+    long long dupBytes;
+    DirstatEstimateSample sample;   // --estimate only
+    double linesCi;                 // --estimate: 95% confidence half-width of `lines`
+} DirstatExtCount;
+
+// One directory of the tree kept with DirstatOptions.buildTree, with its
+// subtree totals. Names are interned, so repeated names such as "src" or
+// "node_modules" are stored once per walker.
+typedef struct DirstatTreeDir {
+    struct DirstatTreeDir *parent;
+    struct DirstatTreeDir *firstChild, *nextSibling;
+    const char *name;     // last path component; the root path for the root
+    long files, dirs;
+    long long bytes, lines;
+} DirstatTreeDir;
+
+// A set of files with identical contents, found with DirstatOptions.duplicates.
+// The first path is taken as the original; the others are the copies.
+typedef struct {
+    long long size;       // bytes of each file
+    int count;            // files in the group, at least 2
+    const char **paths;   // full paths, sorted; owned by the Dirstat
+} DirstatDupGroup;
+
+// Subtree totals of a finished directory, passed to DirstatHooks.directory.
+// Lines are not known per directory with estimateMode.
+typedef struct {
+    long files, dirs;
+    long long bytes, lines, chars;
+} DirstatDirTotals;
+
+// ---------------------------------------------------------------------------
+// Options
+// ---------------------------------------------------------------------------
+
+// I/O backend used to read file contents
+typedef enum {
+    DIRSTAT_IO_SYNC = 0,    // open/read/close per file (default)
+    DIRSTAT_IO_MMAP,        // mmap + MAP_POPULATE for large files, fadvised read() otherwise
+    DIRSTAT_IO_URING        // many openat/read/close in flight through io_uring
+} DirstatIoBackend;
+
+typedef enum {
+    DIRSTAT_SORT_DESCENDING = 0,    // Default
+    DIRSTAT_SORT_ASCENDING,
+    DIRSTAT_SORT_ALPHA_ASC,
+    DIRSTAT_SORT_ALPHA_DESC,
+    DIRSTAT_SORT_NUM_ASC,
+    DIRSTAT_SORT_NUM_DESC,
+    DIRSTAT_SORT_NATURAL_ASC,
+    DIRSTAT_SORT_NATURAL_DESC,
+    DIRSTAT_SORT_SIZE_ASC,
+    DIRSTAT_SORT_SIZE_DESC
+} DirstatSortType;
+
+// What dirstat_top_dirs ranks directories by and dirstat_sort_dirs sorts by
+typedef enum {
+    DIRSTAT_TREE_BY_BYTES = 0,
+    DIRSTAT_TREE_BY_LINES,
+    DIRSTAT_TREE_BY_FILES
+} DirstatTreeKey;
+
+// Fill in with dirstat_options_init, then change what is needed. The
+// strings are only read during dirstat_scan.
+typedef struct {
+    const char **excludes;   // substring or glob patterns of paths to skip
+    int numExcludes;
+    int useGitignore;        // honor .gitignore files
+    int followSymlinks;      // follow symlinks below the root (on by default)
+    int oneFileSystem;       // do not cross mount points
+    int dedupHardlinks;      // count a file reached by several links once, not for every link
+    int jobs;                // walker threads
+    DirstatIoBackend ioBackend;
+    int estimateMode;        // sizes from metadata, lines from a sample
+    double estimateRate;     // share of small files sampled, at least 32 per extension (0 to 1)
+    int binaryDetect;        // count binary files by size only
+    int classify;            // split lines into code, comment and blank by language (no estimate)
+    int duplicates;          // find files with identical contents (dirstat_duplicates)
+    const char **binaryExts; // extensions counted as binary besides the defaults
+    int numBinaryExts;
+    int gitMode;             // only the files in the root's git index
+    int buildTree;           // keep the directory tree (dirstat_tree, dirstat_top_dirs)
+    int watch;               // prepare for dirstat_watch (one job, no estimate, git, tree, duplicates or profile)
+    int profile;             // time the scan (dirstat_print_profile)
+    int useCache;            // read and write the incremental scan cache (off by default)
+    int rebuildCache;        // ignore the existing cache, but write a new one
+    const char *cachePath;   // NULL: $XDG_CACHE_HOME/dirstat/<hash of the root's path>
+} DirstatOptions;
+
+// Called as the scan goes; any of them may be NULL. `path` is the full path.
+// With estimateMode the file hook sees the lines of the files actually read.
+typedef struct {
+    void (*directory)(void *user, const char *path, const DirstatDirTotals *totals);
+    void (*file)(void *user, const char *path, const char *ext, DirstatFileStats stats);
+    void *user;
+} DirstatHooks;
+
+typedef struct Dirstat Dirstat;
+
+// ---------------------------------------------------------------------------
+// Scanning
+// ---------------------------------------------------------------------------
+void dirstat_options_init(DirstatOptions *opts);
+
+// Scan `root`, a directory or a single file. Returns NULL after printing why
+// on stderr if the options do not fit together, the root cannot be stat'ed
+// or opened, the git index cannot be read or the process runs out of file
+// descriptors; unreadable entries below the root are skipped.
+Dirstat *dirstat_scan(const char *root, const DirstatOptions *opts, const DirstatHooks *hooks);
+void dirstat_free(Dirstat *ds);
+
+// Scan several roots at once, filling out[i] with the scan of roots[i] as
+// dirstat_scan would. The directories of all roots share one pool of
+// opts->jobs walker threads, so small roots do not leave threads idle while
+// a big one finishes; with gitMode every root is one task. With useCache
+// each root keeps its own cache file. Returns the number of roots that could not be scanned
+// (their out[i] is NULL), or -1 without scanning if the options do not fit
+// a batch: watch and profile never do, cachePath only for a single root.
+int dirstat_scan_batch(const char **roots, int numRoots, const DirstatOptions *opts, const DirstatHooks *hooks,
+                       Dirstat **out);
+
+// Totals over the whole tree. With estimateMode `lines` is estimated and
+// dirstat_lines_ci is the 95% confidence half-width, 0 otherwise.
+const DirstatProjectStats *dirstat_totals(const Dirstat *ds);
+double dirstat_lines_ci(const Dirstat *ds);
+
+// The extensions seen, sorted; free() the result.
+DirstatExtCount *dirstat_extensions(const Dirstat *ds, DirstatSortType sort, int caseSensitive, int *count);
+
+// duplicates: the groups of identical files, most wasted bytes first, and
+// how many there are. Empty files are never duplicates, nor are several
+// links to one file. NULL with *count = -1 if memory ran out while looking
+// for them; the rest of the results are complete.
+const DirstatDupGroup *dirstat_duplicates(const Dirstat *ds, int *count);
+
+// buildTree: the root of the directory tree, or NULL if the root was not a
+// directory. dirstat_top_dirs fills `out` with the (at most) n largest
+// directories below the root, largest first, and returns how many;
+// dirstat_sort_dirs sorts like it.
+const DirstatTreeDir *dirstat_tree(const Dirstat *ds);
+int dirstat_top_dirs(const Dirstat *ds, DirstatTreeKey key, int n, const DirstatTreeDir **out);
+void dirstat_sort_dirs(const DirstatTreeDir **dirs, size_t n, DirstatTreeKey key);
+
+// profile: the timing report, as text (ascii: '#' bars) or as one JSON object.
+void dirstat_print_profile(const Dirstat *ds, FILE *out, int json, int ascii);
+
+// watch: keep the results current from inotify events. `changed` is called
+// after every update, at most every `interval` seconds; watching stops and
+// dirstat_watch returns when it returns nonzero.
+void dirstat_watch(Dirstat *ds, double interval, int (*changed)(Dirstat *ds, void *user), void *user);
+
+// ---------------------------------------------------------------------------
+// Single files and helpers
+// ---------------------------------------------------------------------------
+DirstatFileStats dirstat_file_stats(const char *filepath);
+const char *dirstat_file_extension(const char *filename);
+void dirstat_format_size(long long bytes, char *buffer, size_t buflen);
+void dirstat_json_print_string(FILE *out, const char *s);
+
+#endif